@@ -20,287 +20,1383 @@
 
 #include "gfsys.h"
 
+#include "statedump.h"
+
 #include "gfdfc.h"
 
-void dfc_sort_initialize(dfc_sort_t * sort)
-{
-    sort->head = sort->data;
-    sort->size = sizeof(sort->data);
-    sort->pending = true;
-}
+// Static probes for tracing tools. They are compiled out when sys/sdt.h is
+// not available. Inodes are identified by a pointer to their gfid.
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define DFC_PROBE(_name, _args...) STAP_PROBEV(gfdfc, _name, ## _args)
+#else
+#define DFC_PROBE(_name, _args...) do { } while (0)
+#endif
+
+#define DFC_GFID(_inode) (((_inode) != NULL) ? (_inode)->gfid : NULL)
+
+err_t dfc_segment_get(dfc_t * dfc, size_t size, dfc_segment_t ** segment)
+{
+    dfc_segment_t * tmp;
+
+    tmp = NULL;
+    if (size <= DFC_SEGMENT_SIZE)
+    {
+        size = DFC_SEGMENT_SIZE;
+
+        sys_mutex_lock(&dfc->segment_lock);
+
+        if (!list_empty(&dfc->segments))
+        {
+            tmp = list_entry(dfc->segments.next, dfc_segment_t, list);
+            list_del_init(&tmp->list);
+            dfc->segment_count--;
+        }
+
+        sys_mutex_unlock(&dfc->segment_lock);
+    }
+
+    if (tmp == NULL)
+    {
+        SYS_ALLOC(
+            &tmp, sizeof(dfc_segment_t) + size, gfdfc_mt_dfc_segment_t,
+            E(),
+            RETERR()
+        );
+
+        INIT_LIST_HEAD(&tmp->list);
+        tmp->length = size;
+    }
+
+    tmp->head = tmp->data;
+    tmp->size = tmp->length;
+
+    *segment = tmp;
+
+    return 0;
+}
+
+void dfc_segment_put(dfc_t * dfc, dfc_segment_t * segment)
+{
+    if (segment->length == DFC_SEGMENT_SIZE)
+    {
+        sys_mutex_lock(&dfc->segment_lock);
+
+        if (dfc->segment_count < dfc->segment_max)
+        {
+            list_add(&segment->list, &dfc->segments);
+            dfc->segment_count++;
+            segment = NULL;
+        }
+
+        sys_mutex_unlock(&dfc->segment_lock);
+    }
+
+    if (segment != NULL)
+    {
+        SYS_FREE(segment);
+    }
+}
+
+void dfc_sort_initialize(dfc_sort_t * sort)
+{
+    INIT_LIST_HEAD(&sort->segments);
+    sort->length = 0;
+    sort->pending = true;
+}
+
+void dfc_sort_release(dfc_t * dfc, dfc_sort_t * sort)
+{
+    dfc_segment_t * segment;
+
+    while (!list_empty(&sort->segments))
+    {
+        segment = list_entry(sort->segments.next, dfc_segment_t, list);
+        list_del_init(&segment->list);
+
+        dfc_segment_put(dfc, segment);
+    }
+
+    dfc_sort_initialize(sort);
+}
+
+void dfc_sort_flatten(dfc_sort_t * sort, void * buffer)
+{
+    dfc_segment_t * segment;
+    size_t size;
+
+    list_for_each_entry(segment, &sort->segments, list)
+    {
+        size = segment->head - (void *)segment->data;
+        memcpy(buffer, segment->data, size);
+        buffer += size;
+    }
+}
+
+err_t dfc_block_create(void * data, size_t size, dfc_block_t ** block)
+{
+    dfc_block_t * tmp;
+    void * buffer, * head;
+    size_t length;
+    err_t error;
+
+    SYS_MALLOC(
+        &tmp, gfdfc_mt_dfc_block_t,
+        E(),
+        RETERR()
+    );
+
+    length = size + DFC_BLOCK_OVERHEAD;
+    SYS_PTR(
+        &buffer, GF_MALLOC, (length, gf_common_mt_char),
+        ENOMEM,
+        E(),
+        GOTO(failed, &error)
+    );
+    head = buffer;
+    SYS_CALL(
+        sys_buf_set_block, (&head, &length, data, size),
+        E(),
+        ASSERT("Internal buffer too small.")
+    );
+
+    // The value is owned by the block and by the dicts it is attached to.
+    tmp->size = head - buffer;
+    SYS_PTR(
+        &tmp->value, data_from_dynptr, (buffer, tmp->size),
+        ENOMEM,
+        E(),
+        GOTO(failed_buffer, &error)
+    );
+    data_ref(tmp->value);
+    tmp->refs = 1;
+
+    *block = tmp;
+
+    return 0;
+
+failed_buffer:
+    GF_FREE(buffer);
+failed:
+    SYS_FREE(tmp);
+
+    return error;
+}
+
+void dfc_block_put(dfc_block_t * block)
+{
+    if (atomic_dec(&block->refs, memory_order_seq_cst) == 1)
+    {
+        data_unref(block->value);
+        SYS_FREE(block);
+    }
+}
+
+void dfc_batch_initialize(dfc_batch_t * batch)
+{
+    batch->blocks = NULL;
+    batch->count = 0;
+    batch->max = 0;
+    batch->length = 0;
+    batch->window = 0;
+    batch->last = 0;
+    batch->gen = 0;
+    batch->armed = false;
+    batch->pending = true;
+}
+
+err_t dfc_batch_add(dfc_batch_t * batch, dfc_block_t * block)
+{
+    dfc_block_t ** blocks;
+    uint32_t max;
+
+    if (batch->count == batch->max)
+    {
+        max = SYS_MAX(batch->max * 2, 16);
+        SYS_ALLOC(
+            &blocks, sizeof(dfc_block_t *) * max, gfdfc_mt_dfc_batch_t,
+            E(),
+            RETERR()
+        );
+        if (batch->blocks != NULL)
+        {
+            memcpy(blocks, batch->blocks, sizeof(dfc_block_t *) * batch->count);
+            SYS_FREE(batch->blocks);
+        }
+        batch->blocks = blocks;
+        batch->max = max;
+    }
+
+    batch->blocks[batch->count++] = block;
+    batch->length += block->size;
+
+    return 0;
+}
+
+// Number of leading blocks that fit into a single request, and their size.
+// At least one block is always taken.
+uint32_t dfc_batch_split(dfc_batch_t * batch, size_t * length)
+{
+    uint32_t count;
+
+    *length = 0;
+    for (count = 0; count < batch->count; count++)
+    {
+        if ((count > 0) &&
+            (*length + batch->blocks[count]->size > DFC_SORT_MAX))
+        {
+            break;
+        }
+        *length += batch->blocks[count]->size;
+    }
+
+    return count;
+}
+
+// Releases the first 'count' blocks, once they have been sent.
+void dfc_batch_consume(dfc_batch_t * batch, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; i < count; i++)
+    {
+        batch->length -= batch->blocks[i]->size;
+        dfc_block_put(batch->blocks[i]);
+    }
+    batch->count -= count;
+    memmove(batch->blocks, batch->blocks + count,
+            sizeof(dfc_block_t *) * batch->count);
+}
+
+void dfc_batch_release(dfc_batch_t * batch)
+{
+    uint32_t i;
+
+    for (i = 0; i < batch->count; i++)
+    {
+        dfc_block_put(batch->blocks[i]);
+    }
+    batch->count = 0;
+    batch->length = 0;
+    batch->pending = true;
+}
+
+uint64_t dfc_time(void)
+{
+    struct timespec now;
+
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
+}
+
+// Adapt the batching window to the arrival rate of sort data. If blocks
+// arrive closer than the maximum window, a delayed send will very likely
+// carry more than one of them, so the window is widened. Otherwise it is
+// progressively closed. 'now' is in microseconds.
+void dfc_batch_adapt(dfc_batching_t * batching, dfc_batch_t * batch,
+                     uint64_t now)
+{
+    if (batching->adaptive)
+    {
+        if ((batch->last != 0) &&
+            (now - batch->last < batching->delay * 1000ULL))
+        {
+            batch->window = SYS_MIN(SYS_MAX(batch->window * 2, 1),
+                                    batching->delay);
+        }
+        else
+        {
+            batch->window /= 2;
+        }
+    }
+    batch->last = now;
+}
+
+uint32_t dfc_batch_window(dfc_batching_t * batching, dfc_batch_t * batch)
+{
+    if (batching->adaptive)
+    {
+        return batch->window;
+    }
+
+    return batching->delay;
+}
+
+void dfc_batch_destroy(dfc_batch_t * batch)
+{
+    dfc_batch_release(batch);
+    if (batch->blocks != NULL)
+    {
+        SYS_FREE(batch->blocks);
+    }
+    dfc_batch_initialize(batch);
+}
+
+err_t __dfc_attach(dfc_t * dfc, int64_t id, int64_t seq, void * data,
+                   size_t size, dict_t ** xdata)
+{
+    int64_t txn_ids[2];
+
+    SYS_CALL(
+        sys_dict_set_uuid, (xdata, DFC_XATTR_UUID, dfc->uuid, NULL),
+        E(),
+        RETERR()
+    );
+
+    txn_ids[0] = hton64(id);
+    txn_ids[1] = hton64(seq);
+    SYS_CALL(
+        sys_dict_set_bin, (xdata, DFC_XATTR_ID, txn_ids, sizeof(txn_ids),
+                           NULL),
+        E(),
+        RETERR()
+    );
+
+    if (data != NULL)
+    {
+        SYS_CALL(
+            sys_dict_set_bin, (xdata, DFC_XATTR_SORT, data, size, NULL),
+            E(),
+            RETERR()
+        );
+    }
+
+/*
+    SYS_CALL(
+        sys_dict_set_int64, (xdata, DFC_XATTR_TIME, time),
+        E(),
+        RETERR()
+    );
+*/
+    return 0;
+}
+
+// Attaches the first 'count' blocks of 'batch'.
+err_t dfc_batch_attach(dfc_t * dfc, int64_t txn, int64_t seq,
+                       dfc_batch_t * batch, uint32_t count, dict_t ** xdata)
+{
+    uint8_t empty;
+    void * data, * head;
+    size_t length;
+    uint32_t i;
+
+    // The sort xattr must always be present, even if it is empty.
+    if (count == 0)
+    {
+        return __dfc_attach(dfc, txn, seq, &empty, 0, xdata);
+    }
+
+    SYS_CALL(
+        __dfc_attach, (dfc, txn, seq, NULL, 0, xdata),
+        E(),
+        RETERR()
+    );
+
+    // A single block is shared with the dict. The dict takes its own
+    // reference, so the block can be released as soon as it is sent.
+    if (count == 1)
+    {
+        if (dict_set(*xdata, DFC_XATTR_SORT, batch->blocks[0]->value) != 0)
+        {
+            return ENOMEM;
+        }
+
+        return 0;
+    }
+
+    // Otherwise the already framed blocks are concatenated into a buffer
+    // owned by the dict.
+    length = 0;
+    for (i = 0; i < count; i++)
+    {
+        length += batch->blocks[i]->size;
+    }
+    SYS_PTR(
+        &data, GF_MALLOC, (length, gf_common_mt_char),
+        ENOMEM,
+        E(),
+        RETERR()
+    );
+    head = data;
+    for (i = 0; i < count; i++)
+    {
+        memcpy(head, batch->blocks[i]->value->data, batch->blocks[i]->size);
+        head += batch->blocks[i]->size;
+    }
+
+    if (dict_set_dynptr(*xdata, DFC_XATTR_SORT, data, length) != 0)
+    {
+        GF_FREE(data);
+
+        return ENOMEM;
+    }
+
+    return 0;
+}
+
+void dfc_cache_initialize(dfc_cache_t * cache, dfc_t * dfc)
+{
+    int32_t i;
+
+    INIT_LIST_HEAD(&cache->list);
+    cache->next = NULL;
+    cache->dfc = dfc;
+    for (i = 0; i < DFC_CACHE_BINS; i++)
+    {
+        INIT_LIST_HEAD(&cache->bins[i].items);
+        cache->bins[i].count = 0;
+    }
+}
+
+void dfc_bin_move(dfc_bin_t * dst, dfc_bin_t * src, uint32_t count)
+{
+    uint32_t i;
+
+    for (i = 0; (i < count) && !list_empty(&src->items); i++)
+    {
+        list_move(src->items.next, &dst->items);
+    }
+    src->count -= i;
+    dst->count += i;
+}
+
+void dfc_cache_release(dfc_cache_t * cache)
+{
+    dfc_transaction_t * txn;
+    dfc_request_t * req;
+    dfc_bin_t * bin;
+
+    bin = &cache->bins[DFC_CACHE_TXN];
+    while (!list_empty(&bin->items))
+    {
+        txn = list_entry(bin->items.next, dfc_transaction_t, list);
+        list_del_init(&txn->list);
+
+        sys_mutex_terminate(&txn->lock);
+        SYS_FREE(txn);
+    }
+    bin->count = 0;
+
+    bin = &cache->bins[DFC_CACHE_REQ];
+    while (!list_empty(&bin->items))
+    {
+        req = list_entry(bin->items.next, dfc_request_t, list);
+        list_del_init(&req->list);
+
+        STACK_DESTROY(req->frame->root);
+        SYS_FREE(req);
+    }
+    bin->count = 0;
+}
+
+// Moves objects exceeding the limit of the shared cache to 'trash' so that
+// they can be released outside of the lock.
+void __dfc_cache_trim(dfc_t * dfc, dfc_cache_t * trash)
+{
+    dfc_bin_t * bin;
+    int32_t i;
+
+    for (i = 0; i < DFC_CACHE_BINS; i++)
+    {
+        bin = &dfc->depot.bins[i];
+        if (bin->count > dfc->cache_max)
+        {
+            dfc_bin_move(&trash->bins[i], bin, bin->count - dfc->cache_max);
+        }
+    }
+}
+
+// All dfc_t share a single thread key. The lock serializes terminating
+// threads with the destruction of dfc_t.
+static pthread_mutex_t dfc_cache_global = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t dfc_cache_key;
+static bool dfc_cache_key_ready = false;
+
+// Called when a thread terminates.
+void dfc_cache_destroy(void * data)
+{
+    dfc_cache_t * cache, * next, trash;
+    dfc_t * dfc;
+    int32_t i;
+
+    pthread_mutex_lock(&dfc_cache_global);
+
+    for (cache = data; cache != NULL; cache = next)
+    {
+        next = cache->next;
+
+        // Caches of destroyed dfc_t are already empty.
+        dfc = cache->dfc;
+        if (dfc != NULL)
+        {
+            dfc_cache_initialize(&trash, dfc);
+
+            sys_mutex_lock(&dfc->cache_lock);
+
+            list_del_init(&cache->list);
+            for (i = 0; i < DFC_CACHE_BINS; i++)
+            {
+                dfc_bin_move(&dfc->depot.bins[i], &cache->bins[i],
+                             cache->bins[i].count);
+            }
+            __dfc_cache_trim(dfc, &trash);
+
+            sys_mutex_unlock(&dfc->cache_lock);
+
+            dfc_cache_release(&trash);
+        }
+
+        SYS_FREE(cache);
+    }
+
+    pthread_mutex_unlock(&dfc_cache_global);
+}
+
+dfc_cache_t * dfc_cache_get(dfc_t * dfc)
+{
+    dfc_cache_t * cache, * head, * tmp, ** pprev;
+
+    head = pthread_getspecific(dfc_cache_key);
+    for (cache = head; cache != NULL; cache = cache->next)
+    {
+        if (cache->dfc == dfc)
+        {
+            return cache;
+        }
+    }
+
+    SYS_MALLOC(
+        &cache, gfdfc_mt_dfc_cache_t,
+        E(),
+        RETVAL(NULL)
+    );
+    dfc_cache_initialize(cache, dfc);
+
+    pthread_mutex_lock(&dfc_cache_global);
+
+    // Caches left by destroyed dfc_t are released here.
+    pprev = &head;
+    while ((tmp = *pprev) != NULL)
+    {
+        if (tmp->dfc == NULL)
+        {
+            *pprev = tmp->next;
+            SYS_FREE(tmp);
+        }
+        else
+        {
+            pprev = &tmp->next;
+        }
+    }
+
+    // This can only fail if the thread had no cache yet, so nothing has
+    // been released above.
+    cache->next = head;
+    if (pthread_setspecific(dfc_cache_key, cache) != 0)
+    {
+        pthread_mutex_unlock(&dfc_cache_global);
+
+        SYS_FREE(cache);
+
+        return NULL;
+    }
+
+    sys_mutex_lock(&dfc->cache_lock);
+
+    list_add_tail(&cache->list, &dfc->caches);
+
+    sys_mutex_unlock(&dfc->cache_lock);
+
+    pthread_mutex_unlock(&dfc_cache_global);
+
+    return cache;
+}
+
+// Takes an object from the cache of the current thread, refilling it from
+// the shared cache if it is empty.
+struct list_head * dfc_cache_take(dfc_t * dfc, int32_t type)
+{
+    dfc_cache_t * cache;
+    dfc_bin_t * bin;
+    struct list_head * item;
+
+    cache = dfc_cache_get(dfc);
+    if (cache == NULL)
+    {
+        return NULL;
+    }
+    bin = &cache->bins[type];
+    if (list_empty(&bin->items))
+    {
+        sys_mutex_lock(&dfc->cache_lock);
+
+        dfc_bin_move(bin, &dfc->depot.bins[type], DFC_CACHE_SIZE / 2);
+
+        sys_mutex_unlock(&dfc->cache_lock);
+
+        if (list_empty(&bin->items))
+        {
+            return NULL;
+        }
+    }
+
+    item = bin->items.next;
+    list_del_init(item);
+    bin->count--;
+
+    return item;
+}
+
+// Returns an object to the cache of the current thread. If it is full, half
+// of it is moved to the shared cache.
+bool dfc_cache_put(dfc_t * dfc, int32_t type, struct list_head * item)
+{
+    dfc_cache_t * cache, trash;
+    dfc_bin_t * bin;
+
+    cache = dfc_cache_get(dfc);
+    if (cache == NULL)
+    {
+        return false;
+    }
+    bin = &cache->bins[type];
+    if (bin->count >= DFC_CACHE_SIZE)
+    {
+        dfc_cache_initialize(&trash, dfc);
+
+        sys_mutex_lock(&dfc->cache_lock);
+
+        dfc_bin_move(&dfc->depot.bins[type], bin, DFC_CACHE_SIZE / 2);
+        __dfc_cache_trim(dfc, &trash);
+
+        sys_mutex_unlock(&dfc->cache_lock);
+
+        dfc_cache_release(&trash);
+    }
+
+    list_add(item, &bin->items);
+    bin->count++;
+
+    return true;
+}
+
+void dfc_request_destroy(dfc_request_t * req)
+{
+    atomic_dec(&req->child->count, memory_order_seq_cst);
+
+    STACK_RESET(req->frame->root);
+    if (!dfc_cache_put(req->child->dfc, DFC_CACHE_REQ, &req->list))
+    {
+        STACK_DESTROY(req->frame->root);
+        SYS_FREE(req);
+    }
+}
+
+err_t dfc_request_create(dfc_child_t * child, dfc_request_t ** req)
+{
+    dfc_request_t * tmp;
+    struct list_head * item;
+    xlator_t * xl;
+    err_t error;
+
+    // Cached requests keep their frame.
+    item = dfc_cache_take(child->dfc, DFC_CACHE_REQ);
+    if (item != NULL)
+    {
+        tmp = list_entry(item, dfc_request_t, list);
+        tmp->child = child;
+
+        atomic_inc(&child->count, memory_order_seq_cst);
+
+        *req = tmp;
+
+        return 0;
+    }
+
+    SYS_MALLOC(
+        &tmp, gfdfc_mt_dfc_request_t,
+        E(),
+        RETERR()
+    );
+
+    xl = child->dfc->xl;
+    SYS_PTR(
+        &tmp->frame, create_frame, (xl, xl->ctx->pool),
+        ENOMEM,
+        E(),
+        GOTO(failed, &error)
+    );
+
+    tmp->child = child;
+    INIT_LIST_HEAD(&tmp->list);
+
+    atomic_inc(&child->count, memory_order_seq_cst);
+
+    *req = tmp;
+
+    return 0;
+
+failed:
+    SYS_FREE(tmp);
+
+    return error;
+}
+
+err_t __dfc_sort_send(dfc_child_t * child, loc_t * loc, int64_t txn,
+                      int64_t seq, dfc_batch_t * batch);
+
+// Children that share a multiplexed sort channel with another child do not
+// keep their own sort requests.
+bool dfc_child_is_leader(dfc_child_t * child)
+{
+    return (child->leader == NULL) || (child->leader == child);
+}
+
+void dfc_child_put(dfc_child_t * child);
+
+// Must be called with dfc->lock held.
+void __dfc_child_state(dfc_child_t * child, int32_t state)
+{
+    uint64_t now;
+
+    now = dfc_time();
+    child->state_time[child->state] += now - child->state_since;
+    child->state_since = now;
+    child->state = state;
+}
+
+// Adjusts the number of sort requests kept by a child. To avoid starvation,
+// there must be enough requests to cover the sort data that arrives during
+// one round trip. Times are in microseconds. Requests parked by the server
+// while waiting for data do not measure the round trip.
+SYS_LOCK_CREATE(dfc_child_adapt, ((dfc_child_t *, child), (uint64_t, latency),
+                                  (bool, data), (bool, parked)))
+{
+    uint64_t now, target;
+
+    if (!parked)
+    {
+        if (child->rtt == 0)
+        {
+            child->rtt = latency;
+        }
+        else
+        {
+            child->rtt = (child->rtt * 7 + latency) / 8;
+        }
+    }
+
+    if (data)
+    {
+        now = dfc_time();
+        if (child->last != 0)
+        {
+            child->gap = (child->gap * 7 + (now - child->last)) / 8;
+        }
+        child->last = now;
+    }
+    else
+    {
+        // An empty reply means that nothing has arrived for a long time.
+        child->gap = SYS_MAX(child->gap, latency);
+    }
+
+    if (child->gap > 0)
+    {
+        target = child->rtt / child->gap + 1;
+        child->polls = SYS_MIN(target, child->dfc->requests);
+    }
+
+    SYS_UNLOCK(&child->lock);
+
+    dfc_child_put(child);
+}
+
+void dfc_request_free(dfc_request_t * req)
+{
+    dfc_child_t * child;
+
+    STACK_RESET(req->frame->root);
+
+    child = req->child;
+    if (child->state == DFC_CHILD_UP)
+    {
+        if ((child->active < child->polls) && dfc_child_is_leader(child))
+        {
+            __dfc_sort_send(child, &child->dfc->root_loc, 0, child->seq,
+                            NULL);
+        }
+        else if ((child->count < SYS_MIN(child->dfc->max_requests,
+                                         child->polls * 4)) ||
+                 list_empty(&child->pool))
+        {
+            list_add_tail(&req->list, &child->pool);
+        }
+        else
+        {
+            dfc_request_destroy(req);
+        }
+    }
+    else
+    {
+        dfc_request_destroy(req);
+    }
+}
+
+// Finalizer of MurmurHash3. Consecutive transaction ids only differ in a few
+// bits, so they need to be spread over the whole table.
+uint64_t dfc_txn_hash(int64_t id)
+{
+    uint64_t hash;
+
+    hash = (uint64_t)id;
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    hash *= 0xC4CEB9FE1A85EC53ULL;
+    hash ^= hash >> 33;
+
+    return hash;
+}
+
+dfc_stripe_t * dfc_txn_stripe(dfc_t * dfc, uint64_t hash)
+{
+    return &dfc->txns[hash & dfc->txn_mask];
+}
+
+// Position of the transaction 'id' inside the stripe, or the position where
+// it should be inserted.
+uint32_t __dfc_txn_find(dfc_stripe_t * stripe, uint64_t hash, int64_t id)
+{
+    dfc_transaction_t * txn;
+    uint32_t idx;
+
+    idx = (hash >> 32) & (stripe->size - 1);
+    while ((txn = stripe->slots[idx]) != NULL)
+    {
+        if (txn->id == id)
+        {
+            break;
+        }
+        idx = (idx + 1) & (stripe->size - 1);
+    }
+
+    return idx;
+}
+
+err_t __dfc_txn_resize(dfc_stripe_t * stripe, uint32_t size)
+{
+    dfc_transaction_t ** slots, ** old;
+    dfc_transaction_t * txn;
+    uint32_t i, count;
+
+    SYS_CALLOC(
+        &slots, size, gfdfc_mt_dfc_stripe_t,
+        E(),
+        RETERR()
+    );
+
+    old = stripe->slots;
+    count = stripe->size;
+    stripe->slots = slots;
+    stripe->size = size;
+    for (i = 0; i < count; i++)
+    {
+        txn = old[i];
+        if (txn != NULL)
+        {
+            slots[__dfc_txn_find(stripe, dfc_txn_hash(txn->id),
+                                 txn->id)] = txn;
+        }
+    }
+
+    SYS_FREE(old);
+
+    return 0;
+}
+
+// Returns the root of the transaction 'num', if it exists. The reference is
+// taken before releasing the stripe, so the transaction cannot be destroyed
+// and reused until the caller releases it with dfc_txn_put().
+dfc_transaction_t * dfc_txn_lookup(dfc_t * dfc, int64_t num)
+{
+    dfc_transaction_t * txn;
+    dfc_stripe_t * stripe;
+    uint64_t hash;
+
+    hash = dfc_txn_hash(num);
+    stripe = dfc_txn_stripe(dfc, hash);
+
+    sys_mutex_lock(&stripe->lock);
+
+    txn = stripe->slots[__dfc_txn_find(stripe, hash, num)];
+    if (txn != NULL)
+    {
+        txn = txn->root;
+        atomic_inc(&txn->refs, memory_order_seq_cst);
+    }
+
+    sys_mutex_unlock(&stripe->lock);
+
+    return txn;
+}
+
+err_t dfc_txn_insert(dfc_t * dfc, dfc_transaction_t * txn)
+{
+    dfc_stripe_t * stripe;
+    uint64_t hash;
+    err_t error = 0;
+
+    hash = dfc_txn_hash(txn->id);
+    stripe = dfc_txn_stripe(dfc, hash);
+
+    sys_mutex_lock(&stripe->lock);
+
+    // The load factor is kept below 3/4. If the table cannot grow it is
+    // still usable while at least one slot remains free.
+    if ((stripe->count + 1) * 4 > stripe->size * 3)
+    {
+        SYS_CALL(
+            __dfc_txn_resize, (stripe, stripe->size * 2),
+            E(),
+            LOG(W(), "Cannot grow the DFC transaction index.")
+        );
+    }
+    if (stripe->count + 1 < stripe->size)
+    {
+        stripe->slots[__dfc_txn_find(stripe, hash, txn->id)] = txn;
+        stripe->count++;
+    }
+    else
+    {
+        error = ENOMEM;
+    }
+
+    sys_mutex_unlock(&stripe->lock);
+
+    return error;
+}
+
+void dfc_txn_remove(dfc_t * dfc, dfc_transaction_t * txn)
+{
+    dfc_transaction_t * tmp;
+    dfc_stripe_t * stripe;
+    uint64_t hash;
+    uint32_t idx, next, home, mask;
+
+    hash = dfc_txn_hash(txn->id);
+    stripe = dfc_txn_stripe(dfc, hash);
+
+    sys_mutex_lock(&stripe->lock);
+
+    mask = stripe->size - 1;
+    idx = __dfc_txn_find(stripe, hash, txn->id);
+    if (stripe->slots[idx] == txn)
+    {
+        // Backward shift deletion: following entries of the same probe
+        // sequence are moved into the hole so that no tombstones are needed.
+        next = (idx + 1) & mask;
+        while ((tmp = stripe->slots[next]) != NULL)
+        {
+            home = (dfc_txn_hash(tmp->id) >> 32) & mask;
+            if (((next - home) & mask) >= ((next - idx) & mask))
+            {
+                stripe->slots[idx] = tmp;
+                idx = next;
+            }
+            next = (next + 1) & mask;
+        }
+        stripe->slots[idx] = NULL;
+        stripe->count--;
+
+        if ((stripe->size > DFC_TXN_SLOTS) &&
+            (stripe->count * 8 < stripe->size))
+        {
+            SYS_CALL(
+                __dfc_txn_resize, (stripe, stripe->size / 2),
+                W()
+            );
+        }
+    }
+
+    sys_mutex_unlock(&stripe->lock);
+}
+
+void dfc_txn_occupancy(dfc_t * dfc, uint32_t * count, uint32_t * size)
+{
+    dfc_stripe_t * stripe;
+    int64_t i;
+
+    *count = 0;
+    *size = 0;
+    for (i = 0; i <= dfc->txn_mask; i++)
+    {
+        stripe = &dfc->txns[i];
+
+        sys_mutex_lock(&stripe->lock);
+
+        *count += stripe->count;
+        *size += stripe->size;
+
+        sys_mutex_unlock(&stripe->lock);
+    }
+}
+
+void dfc_metrics(dfc_t * dfc, dfc_metrics_t * metrics,
+                 dfc_child_metrics_t * children)
+{
+    dfc_child_metrics_t tmp;
+    dfc_child_t * child;
+    uint32_t count, size;
+    uint64_t now;
+    int32_t i;
+
+    memset(metrics, 0, sizeof(dfc_metrics_t));
+    if (children != NULL)
+    {
+        memset(children, 0, sizeof(dfc_child_metrics_t) * dfc->count);
+    }
+
+    sys_mutex_lock(&dfc->lock);
+
+    now = dfc_time();
+    metrics->children = dfc->count;
+    metrics->active = dfc->active;
+    list_for_each_entry(child, &dfc->children, list)
+    {
+        tmp.state = child->state;
+        tmp.active = child->active;
+        tmp.polls = child->polls;
+        tmp.rtt = child->rtt;
+        tmp.pool_hits = child->pool_hits;
+        tmp.pool_misses = child->pool_misses;
+        tmp.bytes_sent = child->bytes_sent;
+        tmp.bytes_received = child->bytes_received;
+        tmp.waiting = child->waiting;
+        for (i = 0; i < DFC_CHILD_STATES; i++)
+        {
+            tmp.state_time[i] = child->state_time[i];
+        }
+        tmp.state_time[child->state] += now - child->state_since;
+
+        metrics->polls += tmp.active;
+        metrics->pool_hits += tmp.pool_hits;
+        metrics->pool_misses += tmp.pool_misses;
+        metrics->bytes_sent += tmp.bytes_sent;
+        metrics->bytes_received += tmp.bytes_received;
+
+        if (children != NULL)
+        {
+            children[child->idx] = tmp;
+        }
+    }
+
+    sys_mutex_unlock(&dfc->lock);
+
+    dfc_txn_occupancy(dfc, &count, &size);
+    metrics->transactions = count;
+    metrics->waiting = dfc->waiting;
+}
+
+static const char * dfc_child_states[] =
+{
+    [DFC_CHILD_DOWN]      = "down",
+    [DFC_CHILD_STARTING]  = "starting",
+    [DFC_CHILD_PREPARING] = "preparing",
+    [DFC_CHILD_STOPPING]  = "stopping",
+    [DFC_CHILD_UP]        = "up",
+    [DFC_CHILD_FAILED]    = "failed"
+};
+
+// Writes the state of the library into the current statedump. It is meant
+// to be called from the 'priv' dump of the translator. Child locks are not
+// taken, so a blocked child can still be inspected.
+void dfc_dump(dfc_t * dfc)
+{
+    char key[GF_DUMP_MAX_BUF_LEN];
+    char uuid[64];
+    dfc_child_metrics_t * children;
+    dfc_metrics_t metrics;
+    dfc_child_metrics_t * tmp;
+    dfc_child_t * child;
+    uint32_t count, size;
+    int32_t i;
+
+    if (dfc == NULL)
+    {
+        return;
+    }
+
+    children = NULL;
+    SYS_CALLOC(
+        &children, dfc->count, gfdfc_mt_dfc_child_metrics_t,
+        E()
+    );
+    dfc_metrics(dfc, &metrics, children);
+
+    uuid_unparse(dfc->uuid, uuid);
+    gf_proc_dump_build_key(key, dfc->xl->name, "dfc");
+    gf_proc_dump_add_section(key);
+
+    gf_proc_dump_write("uuid", "%s", uuid);
+    gf_proc_dump_write("children", "%u (%u active)", dfc->count,
+                       dfc->active);
+    gf_proc_dump_write("current_txn", "%ld", dfc->current_txn);
+
+    dfc_txn_occupancy(dfc, &count, &size);
+    gf_proc_dump_write("transactions", "%u (%u slots)", count, size);
+    gf_proc_dump_write("segments", "%u (max %u)", dfc->segment_count,
+                       dfc->segment_max);
+    gf_proc_dump_write("sort-batch", "%u bytes, %u blocks, %u ms%s",
+                       dfc->batching.bytes, dfc->batching.count,
+                       dfc->batching.delay,
+                       dfc->batching.adaptive ? ", adaptive" : "");
+    gf_proc_dump_write("waiting", "%lu", metrics.waiting);
+    gf_proc_dump_write("outstanding-polls", "%u", metrics.polls);
+    gf_proc_dump_write("pool", "%lu hits, %lu misses", metrics.pool_hits,
+                       metrics.pool_misses);
+    gf_proc_dump_write("sort-bytes", "%lu sent, %lu received",
+                       metrics.bytes_sent, metrics.bytes_received);
+
+    list_for_each_entry(child, &dfc->children, list)
+    {
+        gf_proc_dump_build_key(key, dfc->xl->name, "dfc.child.%d",
+                               child->idx);
+        gf_proc_dump_add_section(key);
+
+        gf_proc_dump_write("name", "%s", child->xl->name);
+        gf_proc_dump_write("state", "%s", dfc_child_states[child->state]);
+        gf_proc_dump_write("seq", "%ld", child->seq);
+        gf_proc_dump_write("requests", "%u (%u active)", child->count,
+                           child->active);
+        gf_proc_dump_write("batch", "%u blocks, %zu bytes, window %u ms",
+                           child->batch.count, child->batch.length,
+                           child->batch.window);
+        gf_proc_dump_write("polls", "%u", child->polls);
+        gf_proc_dump_write("rtt", "%lu", child->rtt);
+        gf_proc_dump_write("gap", "%lu", child->gap);
+        if ((child->leader != NULL) && (child->leader != child))
+        {
+            gf_proc_dump_write("leader", "%s", child->leader->xl->name);
+        }
+
+        if (children == NULL)
+        {
+            continue;
+        }
+        tmp = &children[child->idx];
+        gf_proc_dump_write("waiting", "%lu", tmp->waiting);
+        gf_proc_dump_write("pool", "%lu hits, %lu misses", tmp->pool_hits,
+                           tmp->pool_misses);
+        gf_proc_dump_write("sort-bytes", "%lu sent, %lu received",
+                           tmp->bytes_sent, tmp->bytes_received);
+        for (i = 0; i < DFC_CHILD_STATES; i++)
+        {
+            snprintf(uuid, sizeof(uuid), "time-%s", dfc_child_states[i]);
+            gf_proc_dump_write(uuid, "%lu", tmp->state_time[i]);
+        }
+    }
 
-void dfc_sort_destroy(dfc_sort_t * sort)
-{
-    SYS_FREE(sort);
+    SYS_FREE(children);
 }
 
-err_t dfc_sort_create(dfc_sort_t ** sort)
+// Cached transactions keep their lock initialized.
+err_t dfc_transaction_alloc(dfc_t * dfc, dfc_transaction_t ** txn)
 {
-    dfc_sort_t * tmp;
+    dfc_transaction_t * tmp;
+    struct list_head * item;
 
-    SYS_MALLOC(
-        &tmp, gfdfc_mt_dfc_sort_t,
+    item = dfc_cache_take(dfc, DFC_CACHE_TXN);
+    if (item != NULL)
+    {
+        *txn = list_entry(item, dfc_transaction_t, list);
+
+        return 0;
+    }
+
+    SYS_ALLOC(
+        &tmp,
+        sizeof(dfc_transaction_t) + dfc->count * sizeof(uint64_t) +
+            DFC_MASK_COUNT * dfc->words * sizeof(uint64_t),
+        gfdfc_mt_dfc_transaction_t,
         E(),
         RETERR()
     );
 
-    dfc_sort_initialize(tmp);
+    sys_mutex_initialize(&tmp->lock);
+    INIT_LIST_HEAD(&tmp->list);
 
-    *sort = tmp;
+    *txn = tmp;
 
     return 0;
 }
 
-err_t __dfc_attach(dfc_t * dfc, int64_t id, int64_t seq, void * data,
-                   size_t size, dict_t ** xdata)
+void dfc_transaction_free(dfc_transaction_t * txn)
 {
-    int64_t txn_ids[2];
-
-    SYS_CALL(
-        sys_dict_set_uuid, (xdata, DFC_XATTR_UUID, dfc->uuid, NULL),
-        E(),
-        RETERR()
-    );
-
-    txn_ids[0] = hton64(id);
-    txn_ids[1] = hton64(seq);
-    SYS_CALL(
-        sys_dict_set_bin, (xdata, DFC_XATTR_ID, txn_ids, sizeof(txn_ids),
-                           NULL),
-        E(),
-        RETERR()
-    );
-
-    if (data != NULL)
+    if (!dfc_cache_put(txn->dfc, DFC_CACHE_TXN, &txn->list))
     {
-        SYS_CALL(
-            sys_dict_set_bin, (xdata, DFC_XATTR_SORT, data, size, NULL),
-            E(),
-            RETERR()
-        );
+        sys_mutex_terminate(&txn->lock);
+        SYS_FREE(txn);
     }
-
-/*
-    SYS_CALL(
-        sys_dict_set_int64, (xdata, DFC_XATTR_TIME, time),
-        E(),
-        RETERR()
-    );
-*/
-    return 0;
 }
 
-void dfc_request_destroy(dfc_request_t * req)
+void dfc_txn_put(dfc_transaction_t * txn)
 {
-    atomic_dec(&req->child->count, memory_order_seq_cst);
+    if (atomic_dec(&txn->refs, memory_order_seq_cst) == 1)
+    {
+        if (txn->root != txn)
+        {
+            dfc_txn_put(txn->root);
+        }
 
-    STACK_DESTROY(req->frame->root);
-    SYS_FREE(req);
-}
+        if (txn->inode != NULL)
+        {
+            inode_unref(txn->inode);
+        }
 
-err_t dfc_request_create(dfc_child_t * child, dfc_request_t ** req)
-{
-    dfc_request_t * tmp;
-    xlator_t * xl;
-    err_t error;
+        dfc_sort_release(txn->dfc, &txn->sort);
 
-    SYS_MALLOC(
-        &tmp, gfdfc_mt_dfc_request_t,
-        E(),
-        RETERR()
-    );
+        dfc_transaction_free(txn);
+    }
+}
 
-    xl = child->dfc->xl;
-    SYS_PTR(
-        &tmp->frame, create_frame, (xl, xl->ctx->pool),
-        ENOMEM,
-        E(),
-        GOTO(failed, &error)
-    );
+bool dfc_mask_test(const uint64_t * mask, int32_t idx);
 
-    tmp->child = child;
-    INIT_LIST_HEAD(&tmp->list);
-    dfc_sort_initialize(&tmp->sort);
+void dfc_transaction_destroy(dfc_transaction_t * txn)
+{
+    dfc_child_t * child;
 
-    atomic_inc(&child->count, memory_order_seq_cst);
+    dfc_txn_remove(txn->dfc, txn);
 
-    *req = tmp;
+    // Sort data that has not arrived yet is not waited for anymore.
+    sys_mutex_lock(&txn->lock);
 
-    return 0;
+    if (txn->waiting > 0)
+    {
+        list_for_each_entry(child, &txn->dfc->children, list)
+        {
+            if (dfc_mask_test(txn->mask, child->idx) &&
+                !dfc_mask_test(txn->sorted, child->idx))
+            {
+                atomic_dec(&child->waiting, memory_order_relaxed);
+            }
+        }
+        txn->waiting = 0;
+        atomic_dec(&txn->dfc->waiting, memory_order_relaxed);
+    }
 
-failed:
-    SYS_FREE(tmp);
+    sys_mutex_unlock(&txn->lock);
 
-    return error;
+    dfc_txn_put(txn);
 }
 
-err_t __dfc_sort_send(dfc_child_t * child, loc_t * loc, int64_t txn,
-                      int64_t seq, dfc_sort_t * sort);
+bool dfc_mask_test(const uint64_t * mask, int32_t idx)
+{
+    return (mask[idx / DFC_MASK_BITS] & (1ULL << (idx % DFC_MASK_BITS))) != 0;
+}
 
-void dfc_request_free(dfc_request_t * req)
+void dfc_mask_set(uint64_t * mask, int32_t idx)
 {
-    dfc_child_t * child;
-    dfc_sort_t sort;
+    mask[idx / DFC_MASK_BITS] |= 1ULL << (idx % DFC_MASK_BITS);
+}
 
-    STACK_RESET(req->frame->root);
+int32_t dfc_mask_first(dfc_t * dfc, const uint64_t * mask)
+{
+    uint32_t i;
 
-    child = req->child;
-    if (child->state == DFC_CHILD_UP)
+    for (i = 0; i < dfc->words; i++)
     {
-        if (child->active < child->dfc->requests)
-        {
-            dfc_sort_initialize(&sort);
-            __dfc_sort_send(child, &child->dfc->root_loc, 0, child->seq,
-                            &sort);
-        }
-        else if ((child->count < child->dfc->max_requests) ||
-                 list_empty(&child->pool))
+        if (mask[i] != 0)
         {
-            list_add_tail(&req->list, &child->pool);
-        }
-        else
-        {
-            dfc_request_destroy(req);
+            return i * DFC_MASK_BITS + __builtin_ctzll(mask[i]);
         }
     }
-    else
-    {
-        dfc_request_destroy(req);
-    }
+
+    return -1;
 }
 
-void dfc_transaction_destroy(dfc_transaction_t * txn)
+uint32_t dfc_mask_count(dfc_t * dfc, const uint64_t * mask)
 {
-    sys_mutex_lock(&txn->dfc->lock);
-
-    list_del_init(&txn->list);
+    uint32_t i, count;
 
-    sys_mutex_unlock(&txn->dfc->lock);
-
-    if (txn->inode != NULL)
+    count = sys_bits_count64(mask[0]);
+    for (i = 1; i < dfc->words; i++)
     {
-        inode_unref(txn->inode);
+        count += sys_bits_count64(mask[i]);
     }
 
-    SYS_FREE(txn);
+    return count;
 }
 
 SYS_LOCK_DECLARE(dfc_sort_send, ((dfc_child_t *, child),
                                  (loc_t, loc, PTR, sys_loc_acquire,
                                                    sys_loc_release),
                                  (int64_t, txn),
-                                 (int64_t, seq),
-                                 (dfc_sort_t *, sort)));
+                                 (int64_t, seq)));
 
 SYS_ASYNC_CREATE(dfc_transaction_extra, ((dfc_t *, dfc),
-                                         (uint64_t, mask),
                                          (dfc_transaction_t *, txn)))
 {
     loc_t loc;
     dfc_child_t * child;
-    int32_t i;
 
     memset(&loc, 0, sizeof(loc));
     loc.inode = txn->inode;
-    i = 0;
 
     sys_mutex_lock(&dfc->lock);
 
     list_for_each_entry(child, &dfc->children, list)
     {
-        if (mask & 1)
+        if (dfc_mask_test(txn->bits, child->idx))
         {
             SYS_LOCK(
                 &child->lock,
-                dfc_sort_send, (child, &loc, txn->id, txn->seqs[i],
-                                NULL)
+                dfc_sort_send, (child, &loc, txn->id, txn->seqs[child->idx])
             );
-            mask ^= 1;
-            if (mask == 0)
-            {
-                break;
-            }
         }
-        mask >>= 1;
-        i++;
     }
 
     sys_mutex_unlock(&dfc->lock);
-}
-
-dfc_transaction_t * dfc_txn_lookup(dfc_t * dfc, int64_t num)
-{
-    dfc_transaction_t * txn;
-    struct list_head * item;
-    int64_t id;
-
-    id = num & dfc->txn_mask;
-    item = dfc->txns[id].next;
-    txn = NULL;
-    while (item != &dfc->txns[id])
-    {
-        txn = list_entry(item, dfc_transaction_t, list);
-        if (txn->id >= num)
-        {
-            if (txn->id != num)
-            {
-                txn = NULL;
-            }
-            break;
-        }
-        item = item->next;
-    }
-
-    return txn;
-}
-
-void dfc_txn_insert(dfc_t * dfc, dfc_transaction_t * txn)
-{
-    dfc_transaction_t * tmp;
-    struct list_head * item;
-    int64_t id;
-
-    id = txn->id & dfc->txn_mask;
-    item = dfc->txns[id].prev;
-    while (item != &dfc->txns[id])
-    {
-        tmp = list_entry(item, dfc_transaction_t, list);
-        if (tmp->id <= txn->id)
-        {
-            break;
-        }
-        item = item->prev;
-    }
 
-    list_add(&txn->list, item);
+    dfc_txn_put(txn);
 }
 
-err_t dfc_transaction_create(dfc_t * dfc, uint64_t mask, inode_t * inode,
-                             dict_t * xdata, dfc_transaction_t ** txn)
+err_t dfc_transaction_create(dfc_t * dfc, const uint64_t * mask,
+                             inode_t * inode, dict_t * xdata,
+                             dfc_transaction_t ** txn)
 {
     dfc_transaction_t * tmp, * aux;
     dfc_child_t * child;
     int64_t txn_ids[2];
-    uint64_t bits;
+    uint64_t * words, bits;
+    void * ptr;
     size_t len;
     int32_t i;
     err_t error;
 
-    SYS_ALLOC(
-        &tmp,
-        sizeof(dfc_transaction_t) + dfc->count * sizeof(uint64_t),
-        gfdfc_mt_dfc_transaction_t,
+    SYS_CALL(
+        dfc_transaction_alloc, (dfc, &tmp),
         E(),
         RETERR()
     );
 
-    tmp->dfc = dfc;
-    tmp->mask = mask;
-    tmp->sorted = 0;
-    tmp->state = sys_bits_count64(mask);
-    tmp->state |= tmp->state << 16;
+    words = &tmp->seqs[dfc->count];
+    tmp->mask = words;
+    tmp->group = words + dfc->words;
+    tmp->sorted = words + dfc->words * 2;
+    tmp->extra = words + dfc->words * 3;
+    tmp->bits = words + dfc->words * 4;
 
-    sys_mutex_lock(&dfc->lock);
+    tmp->dfc = dfc;
+    memcpy(tmp->mask, mask, dfc->words * sizeof(uint64_t));
+    memset(tmp->sorted, 0, dfc->words * sizeof(uint64_t));
+    dfc_sort_initialize(&tmp->sort);
+    tmp->state = dfc_mask_count(dfc, mask);
+    tmp->state |= tmp->state << DFC_STATE_SHIFT;
+    tmp->complete = false;
+    tmp->waiting = 0;
+    tmp->refs = 1;
 
     len = sizeof(txn_ids);
     if (sys_dict_get_bin(xdata, DFC_XATTR_ID, txn_ids, &len) == 0)
@@ -318,123 +1414,275 @@ err_t dfc_transaction_create(dfc_t * dfc, uint64_t mask, inode_t * inode,
             E(),
             GOTO(failed, &error)
         );
-        aux = aux->root;
         tmp->root = aux;
-        tmp->id = ++aux->subtxn;
         for (i = 0; i < dfc->count; i++)
         {
             tmp->seqs[i] = aux->seqs[i] | INT64_MIN;
         }
         tmp->inode = inode_ref(aux->inode);
 
-        aux->group |= mask;
-        tmp->group = aux->group;
-        bits = aux->group & ~mask & ~aux->extra;
-        aux->extra |= bits;
-        tmp->extra = aux->extra;
+        // Subtransactions only need to serialize with other subtransactions
+        // of the same root.
+        sys_mutex_lock(&aux->lock);
+
+        if (aux->subtxn - aux->id >= DFC_TXN_SUBTXNS)
+        {
+            sys_mutex_unlock(&aux->lock);
+
+            logE("Too many subtransactions for transaction %ld", aux->id);
+            error = ERANGE;
 
-        dfc_txn_insert(dfc, tmp);
+            goto failed_inode;
+        }
+        // The subtransaction is indexed before updating the root, so that
+        // nothing needs to be undone if it fails.
+        tmp->id = aux->subtxn + 1;
+        SYS_CALL(
+            dfc_txn_insert, (dfc, tmp),
+            E(),
+            GOTO(failed_lock, &error)
+        );
+        aux->subtxn = tmp->id;
+        bits = 0;
+        for (i = 0; i < dfc->words; i++)
+        {
+            aux->group[i] |= mask[i];
+            tmp->group[i] = aux->group[i];
+            tmp->bits[i] = aux->group[i] & ~mask[i] & ~aux->extra[i];
+            aux->extra[i] |= tmp->bits[i];
+            tmp->extra[i] = aux->extra[i];
+            bits |= tmp->bits[i];
+        }
 
-        dfc_sort_initialize(&tmp->sort);
-        sys_buf_set_int64(&tmp->sort.head, &tmp->sort.size, tmp->id);
+        sys_mutex_unlock(&aux->lock);
 
-        sys_mutex_initialize(&tmp->lock);
+        ptr = tmp->header;
+        __sys_buf_set_int64(&ptr, tmp->id);
 
         if (bits != 0)
         {
-            SYS_ASYNC(dfc_transaction_extra, (dfc, bits, tmp));
+            // The transaction may complete before the job runs.
+            atomic_inc(&tmp->refs, memory_order_seq_cst);
+            SYS_ASYNC(dfc_transaction_extra, (dfc, tmp));
         }
     }
     else
     {
-        tmp->group = mask;
-        tmp->extra = 0;
+        memcpy(tmp->group, mask, dfc->words * sizeof(uint64_t));
+        memset(tmp->extra, 0, dfc->words * sizeof(uint64_t));
         if (inode != NULL)
         {
             inode = inode_ref(inode);
         }
         tmp->inode = inode;
-        dfc->current_txn += 256;
-        tmp->subtxn = tmp->id = dfc->current_txn;
         tmp->root = tmp;
-        i = 0;
-        list_for_each_entry(child, &dfc->children, list)
+
+        // When a single child is involved, the dependencies computed by it
+        // are already complete and no sort exchange is needed. Only the
+        // sequence of that child needs to be updated. Servers that do not
+        // understand DFC_XATTR_DEPS would wait for sort data forever.
+        child = NULL;
+        if ((tmp->state & DFC_STATE_MASK) == 1)
         {
-            if (mask & 1)
+            child = dfc->child_index[dfc_mask_first(dfc, mask)];
+            if ((child->features & DFC_FEATURE_DEPS) != 0)
             {
-                tmp->seqs[i] = ++child->seq;
+                tmp->complete = true;
+                tmp->state &= ~DFC_STATE_MASK;
+                memset(tmp->seqs, 0xFF, dfc->count * sizeof(uint64_t));
             }
             else
             {
-                tmp->seqs[i] = -1;
+                child = NULL;
+            }
+        }
+
+        // The servers expect the sequence numbers of each child to follow
+        // the order of transaction ids, so both are allocated together. The
+        // list of children never changes once created.
+        sys_mutex_lock(&dfc->txn_lock);
+
+        dfc->current_txn += 1LL << DFC_TXN_SHIFT;
+        tmp->subtxn = tmp->id = dfc->current_txn;
+        if (child != NULL)
+        {
+            tmp->seqs[child->idx] = ++child->seq;
+        }
+        else
+        {
+            list_for_each_entry(child, &dfc->children, list)
+            {
+                if (dfc_mask_test(mask, child->idx))
+                {
+                    tmp->seqs[child->idx] = ++child->seq;
+                    atomic_inc(&child->waiting, memory_order_relaxed);
+                    tmp->waiting++;
+                }
+                else
+                {
+                    tmp->seqs[child->idx] = -1;
+                }
+            }
+            if (tmp->waiting > 0)
+            {
+                atomic_inc(&dfc->waiting, memory_order_relaxed);
             }
-            i++;
-            mask >>= 1;
         }
 
-        dfc_txn_insert(dfc, tmp);
+        sys_mutex_unlock(&dfc->txn_lock);
 
-        dfc_sort_initialize(&tmp->sort);
-        sys_buf_set_int64(&tmp->sort.head, &tmp->sort.size, tmp->id);
+        // Sequence numbers have already been consumed, so the transaction
+        // must go on. It will only be unable to receive sort data.
+        SYS_CALL(
+            dfc_txn_insert, (dfc, tmp),
+            E(),
+            LOG(E(), "Transaction %ld cannot be indexed", tmp->id)
+        );
 
-        sys_mutex_initialize(&tmp->lock);
+        ptr = tmp->header;
+        __sys_buf_set_int64(&ptr, tmp->id);
     }
-    sys_mutex_unlock(&dfc->lock);
+
+    DFC_PROBE(transaction_create, tmp->id, tmp->root->id,
+              DFC_GFID(tmp->inode), tmp->complete);
 
     *txn = tmp;
 
     return 0;
 
+failed_lock:
+    sys_mutex_unlock(&tmp->root->lock);
+failed_inode:
+    inode_unref(tmp->inode);
+    dfc_txn_put(tmp->root);
 failed:
-    SYS_FREE(tmp);
+    dfc_transaction_free(tmp);
 
     return error;
 }
 
 err_t dfc_sort_update(dfc_t * dfc, dfc_sort_t * sort, uuid_t uuid, int64_t txn)
 {
+    dfc_segment_t * segment;
     uuid_t * client;
     void * ptr, * top, * aux;
     int64_t current;
 
-    ptr = sort->data;
-    top = ptr + sizeof(sort->data) - sort->size;
-    __sys_buf_get_int64(&ptr);
-    while (ptr < top)
+    list_for_each_entry(segment, &sort->segments, list)
     {
-        client = __sys_buf_ptr_uuid(&ptr);
-        aux = ptr;
-        current = __sys_buf_get_int64(&ptr);
-
-        if (uuid_compare(uuid, *client) == 0)
+        ptr = segment->data;
+        top = segment->head;
+        if (segment->list.prev == &sort->segments)
+        {
+            __sys_buf_get_int64(&ptr);
+        }
+        while (ptr < top)
         {
-            if ((uuid_compare(uuid, dfc->uuid) < 0) ^ (current > txn))
+            client = __sys_buf_ptr_uuid(&ptr);
+            aux = ptr;
+            current = __sys_buf_get_int64(&ptr);
+
+            if (uuid_compare(uuid, *client) == 0)
             {
-                __sys_buf_set_int64(&aux, txn);
-            }
+                if ((uuid_compare(uuid, dfc->uuid) < 0) ^ (current > txn))
+                {
+                    __sys_buf_set_int64(&aux, txn);
+                }
 
-            return 0;
+                return 0;
+            }
         }
     }
 
+    segment = list_entry(sort->segments.prev, dfc_segment_t, list);
+    if (sys_buf_check(&segment->size, sizeof(uuid_t) + sizeof(int64_t)) != 0)
+    {
+        SYS_CALL(
+            dfc_segment_get, (dfc, DFC_SEGMENT_SIZE, &segment),
+            E(),
+            RETERR()
+        );
+        list_add_tail(&segment->list, &sort->segments);
+
+        SYS_CALL(
+            sys_buf_check, (&segment->size, sizeof(uuid_t) + sizeof(int64_t)),
+            E(),
+            ASSERT("Internal buffer too small.")
+        );
+    }
+
+    __sys_buf_set_uuid(&segment->head, uuid);
+    __sys_buf_set_int64(&segment->head, txn);
+    sort->length += sizeof(uuid_t) + sizeof(int64_t);
+
+    return 0;
+}
+
+void dfc_request_send(dfc_t * dfc, const uint64_t * mask,
+                      dfc_block_t * block);
+
+err_t dfc_transaction_send(dfc_transaction_t * txn)
+{
+    dfc_segment_t * segment;
+    dfc_block_t * block;
+    void * data, * buffer;
+    size_t size;
+    err_t error;
+
+    // Transactions that have not received any dependency only need to send
+    // their id.
+    buffer = NULL;
+    data = txn->header;
+    size = sizeof(txn->header);
+    if (txn->sort.length > 0)
+    {
+        segment = list_entry(txn->sort.segments.next, dfc_segment_t, list);
+        data = segment->data;
+        size = txn->sort.length;
+        if (segment->list.next != &txn->sort.segments)
+        {
+            // Data spread over several segments must be made contiguous
+            // before framing it.
+            SYS_PTR(
+                &buffer, GF_MALLOC, (size, gf_common_mt_char),
+                ENOMEM,
+                E(),
+                LOG(E(), "Cannot prepare DFC sort data of transaction %ld",
+                    txn->id),
+                RETERR()
+            );
+            dfc_sort_flatten(&txn->sort, buffer);
+            data = buffer;
+        }
+    }
     SYS_CALL(
-        sys_buf_check, (&sort->size, sizeof(uuid_t) + sizeof(int64_t)),
+        dfc_block_create, (data, size, &block),
         E(),
-        RETERR()
+        LOG(E(), "Cannot prepare DFC sort data of transaction %ld", txn->id),
+        GOTO(failed, &error)
     );
+    dfc_sort_release(txn->dfc, &txn->sort);
 
-    __sys_buf_set_uuid(&sort->head, uuid);
-    __sys_buf_set_int64(&sort->head, txn);
+    dfc_request_send(txn->dfc, txn->sorted, block);
 
-    return 0;
-}
+    dfc_block_put(block);
+
+    error = 0;
+
+failed:
+    if (buffer != NULL)
+    {
+        GF_FREE(buffer);
+    }
 
-void dfc_request_send(dfc_t * dfc, uint64_t mask, void * data, size_t size);
+    return error;
+}
 
 err_t dfc_sort_process_one(dfc_t * dfc, dfc_child_t * child, void * data,
                            size_t size)
 {
     dfc_transaction_t * txn;
+    dfc_segment_t * segment;
     uuid_t * uuid;
     int64_t num, need;
     err_t error;
@@ -443,18 +1691,9 @@ err_t dfc_sort_process_one(dfc_t * dfc, dfc_child_t * child, void * data,
         sys_buf_get_int64, (&data, &size, &num),
         E(),
         RETERR()
-    );
-
-    sys_mutex_lock(&dfc->lock);
-
-    txn = dfc_txn_lookup(dfc, num);
-    if (txn != NULL)
-    {
-        txn = txn->root;
-    }
-
-    sys_mutex_unlock(&dfc->lock);
+    );
 
+    txn = dfc_txn_lookup(dfc, num);
     SYS_TEST(
         txn != NULL,
         ENOENT,
@@ -464,6 +1703,25 @@ err_t dfc_sort_process_one(dfc_t * dfc, dfc_child_t * child, void * data,
 
     sys_mutex_lock(&txn->lock);
 
+    if ((size > 0) && list_empty(&txn->sort.segments))
+    {
+        SYS_CALL(
+            dfc_segment_get, (dfc, DFC_SEGMENT_SIZE, &segment),
+            E(),
+            LOG(E(), "Cannot allocate buffers for DFC sort."),
+            GOTO(failed_lock, &error)
+        );
+        list_add_tail(&segment->list, &txn->sort.segments);
+
+        SYS_CALL(
+            sys_buf_set_raw, (&segment->head, &segment->size, txn->header,
+                              sizeof(txn->header)),
+            E(),
+            ASSERT("Internal buffer too small.")
+        );
+        txn->sort.length = sizeof(txn->header);
+    }
+
     while (size > 0)
     {
         SYS_CALL(
@@ -484,7 +1742,18 @@ err_t dfc_sort_process_one(dfc_t * dfc, dfc_child_t * child, void * data,
         );
     }
 
-    txn->sorted |= 1ULL << child->idx;
+    if (!dfc_mask_test(txn->sorted, child->idx))
+    {
+        dfc_mask_set(txn->sorted, child->idx);
+        if ((txn->waiting > 0) && dfc_mask_test(txn->mask, child->idx))
+        {
+            atomic_dec(&child->waiting, memory_order_relaxed);
+            if (--txn->waiting == 0)
+            {
+                atomic_dec(&txn->dfc->waiting, memory_order_relaxed);
+            }
+        }
+    }
 
     SYS_TEST(
         size == 0,
@@ -499,33 +1768,37 @@ err_t dfc_sort_process_one(dfc_t * dfc, dfc_child_t * child, void * data,
 failed_lock:
     sys_mutex_unlock(&txn->lock);
 
-    if ((atomic_dec(&txn->state, memory_order_seq_cst) & 0xFFFF) == 1)
+    if ((atomic_dec(&txn->state, memory_order_seq_cst) & DFC_STATE_MASK) == 1)
     {
-        dfc_request_send(txn->dfc, txn->sorted, txn->sort.data,
-                         sizeof(txn->sort.data) - txn->sort.size);
+        dfc_transaction_send(txn);
     }
 
+    dfc_txn_put(txn);
+
     return error;
 }
 
-err_t dfc_sort_process(dfc_t * dfc, dfc_child_t * child, dfc_sort_t * sort)
+err_t dfc_sort_process(dfc_t * dfc, dfc_child_t * child, void * data,
+                       size_t size)
 {
-    void * data;
+    void * block;
     uint32_t length;
 
-    while (sort->size > 0)
+    atomic_add(&child->bytes_received, size, memory_order_relaxed);
+
+    while (size > 0)
     {
         SYS_CALL(
-            sys_buf_ptr_block, (&sort->head, &sort->size, &data, &length),
+            sys_buf_ptr_block, (&data, &size, &block, &length),
             E(),
             RETERR()
         );
 
-        dfc_sort_process_one(dfc, child, data, length);
+        dfc_sort_process_one(dfc, child, block, length);
     }
 
     SYS_TEST(
-        sort->size == 0,
+        size == 0,
         EINVAL,
         E(),
         RETERR()
@@ -534,14 +1807,75 @@ err_t dfc_sort_process(dfc_t * dfc, dfc_child_t * child, dfc_sort_t * sort)
     return 0;
 }
 
+void dfc_reply(dfc_transaction_t * txn, int32_t idx, dict_t * xdata)
+{
+    data_t * value;
+
+    if ((txn == NULL) || (xdata == NULL) || (idx < 0) ||
+        (idx >= txn->dfc->count))
+    {
+        return;
+    }
+
+    // The server may attach pending sort data to any fop reply if the
+    // consumer enabled it with dfc_set_piggyback().
+    value = dict_get(xdata, DFC_XATTR_SORT);
+    if (value == NULL)
+    {
+        return;
+    }
+
+    SYS_CALL(
+        dfc_sort_process, (txn->dfc, txn->dfc->child_index[idx], value->data,
+                           value->len),
+        E()
+    );
+
+    dict_del(xdata, DFC_XATTR_SORT);
+}
+
+// Replies from a multiplexed channel contain the sort data of each brick of
+// the same process under its own key.
+bool dfc_sort_demux(dfc_t * dfc, dfc_child_t * child, dict_t * dict)
+{
+    dfc_child_t * tmp;
+    data_t * value;
+    char key[64];
+    bool found;
+
+    found = false;
+    list_for_each_entry(tmp, &dfc->children, list)
+    {
+        if (uuid_compare(tmp->process, child->process) == 0)
+        {
+            snprintf(key, sizeof(key), "%s.%u", DFC_XATTR_SORT,
+                     (uint32_t)tmp->brick);
+            value = dict_get(dict, key);
+            if (value != NULL)
+            {
+                SYS_CALL(
+                    dfc_sort_process, (dfc, tmp, value->data, value->len),
+                    E()
+                );
+                found = true;
+            }
+        }
+    }
+
+    return found;
+}
+
 SYS_CBK_CREATE(dfc_sort_recv, data, ((dfc_t *, dfc), (dfc_request_t *, req)))
 {
     SYS_GF_WIND_CBK_TYPE(getxattr) * args;
-    dfc_sort_t * sort;
+    data_t * value;
+    bool found, parked;
 
     atomic_dec(&req->child->active, memory_order_seq_cst);
 
     args = (SYS_GF_WIND_CBK_TYPE(getxattr) *)data;
+    DFC_PROBE(sort_recv, req->child->idx, args->op_ret, args->op_errno,
+              dfc_time() - req->sent);
     if (args->op_ret < 0)
     {
         if ((args->op_errno == ENOTCONN) || (args->op_errno == ENODATA) ||
@@ -555,34 +1889,57 @@ SYS_CBK_CREATE(dfc_sort_recv, data, ((dfc_t *, dfc), (dfc_request_t *, req)))
         return;
     }
 
-    sort = &req->sort;
-    sort->head = sort->data;
-    sort->size = sizeof(sort->data);
-    SYS_CALL(
-        sys_dict_get_bin, (args->dict, DFC_XATTR_SORT, sort->data,
-                           &sort->size),
+    // Empty replies are sent when the request times out on the server.
+    parked = (args->dict == NULL) ||
+             (dict_get(args->dict, DFC_XATTR_PARKED) != NULL);
+
+    found = false;
+    value = NULL;
+    if (args->dict != NULL)
+    {
+        value = dict_get(args->dict, DFC_XATTR_SORT);
+        if ((value == NULL) && !uuid_is_null(req->child->process))
+        {
+            found = dfc_sort_demux(dfc, req->child, args->dict);
+
+            goto done;
+        }
+    }
+    SYS_TEST(
+        value != NULL,
+        ENODATA,
         T(),
         GOTO(done)
     );
 
+    // Sort data is parsed directly from the reply.
     SYS_CALL(
-        dfc_sort_process, (dfc, req->child, sort),
+        dfc_sort_process, (dfc, req->child, value->data, value->len),
         E()
     );
+    found = value->len > 0;
 
 done:
+    atomic_inc(&req->child->refs, memory_order_seq_cst);
+    SYS_LOCK(&req->child->lock, dfc_child_adapt,
+             (req->child, dfc_time() - req->sent, found, parked));
+
     dfc_request_free(req);
 }
 
 err_t __dfc_sort_send(dfc_child_t * child, loc_t * loc, int64_t txn,
-                      int64_t seq, dfc_sort_t * sort)
+                      int64_t seq, dfc_batch_t * batch)
 {
     dfc_request_t * req;
     dict_t * xdata;
+    uint8_t empty;
+    size_t length;
+    uint32_t count;
     err_t error;
 
     if (list_empty(&child->pool))
     {
+        atomic_inc(&child->pool_misses, memory_order_relaxed);
         SYS_CALL(
             dfc_request_create, (child, &req),
             E(),
@@ -592,19 +1949,38 @@ err_t __dfc_sort_send(dfc_child_t * child, loc_t * loc, int64_t txn,
     }
     else
     {
+        atomic_inc(&child->pool_hits, memory_order_relaxed);
         req = list_entry(child->pool.next, dfc_request_t, list);
         list_del_init(&req->list);
     }
 
+    count = 0;
+    length = 0;
+    if (batch != NULL)
+    {
+        count = dfc_batch_split(batch, &length);
+    }
+
     xdata = NULL;
     SYS_CALL(
-        __dfc_attach, (child->dfc, txn, seq, sort->data,
-                       sizeof(sort->data) - sort->size, &xdata),
+        dfc_batch_attach, (child->dfc, txn, seq, batch, count, &xdata),
         E(),
         LOG(E(), "Failed to prepare a DFC sort request."),
         GOTO(failed, &error)
     );
+    if (child->leader != NULL)
+    {
+        SYS_CALL(
+            sys_dict_set_bin, (&xdata, DFC_XATTR_MUX, &empty, 0, NULL),
+            E(),
+            LOG(E(), "Failed to prepare a DFC sort request."),
+            GOTO(failed_xdata, &error)
+        );
+    }
 
+    atomic_add(&child->bytes_sent, length, memory_order_relaxed);
+    DFC_PROBE(sort_send, child->idx, txn, seq, length);
+    req->sent = dfc_time();
     atomic_inc(&child->active, memory_order_seq_cst);
     SYS_IO(sys_gf_getxattr_wind, (req->frame, NULL, child->xl, loc,
                                   DFC_XATTR_SORT, xdata),
@@ -612,102 +1988,155 @@ err_t __dfc_sort_send(dfc_child_t * child, loc_t * loc, int64_t txn,
 
     sys_dict_release(xdata);
 
+    if (batch != NULL)
+    {
+        dfc_batch_consume(batch, count);
+    }
+
     return 0;
 
+failed_xdata:
+    sys_dict_release(xdata);
 failed:
     dfc_request_free(req);
 
     return error;
 }
 
+void __dfc_sort_flush(dfc_child_t * child);
+
 SYS_LOCK_DEFINE(dfc_sort_send, ((dfc_child_t *, child),
                                 (loc_t, loc, PTR, sys_loc_acquire,
                                                   sys_loc_release),
                                 (int64_t, txn),
-                                (int64_t, seq),
-                                (dfc_sort_t *, sort)))
+                                (int64_t, seq)))
 {
-    if (sort == NULL)
-    {
-        sort = child->sort;
-    }
-
     SYS_CALL(
-        __dfc_sort_send, (child, loc, txn, seq, sort),
+        __dfc_sort_send, (child, loc, txn, seq, &child->batch),
         E(),
         GOTO(failed)
     );
 
-    if (child->sort == sort)
+    // Data that did not fit into the request is sent by another one.
+    if (child->batch.count > 0)
     {
-        dfc_sort_initialize(sort);
+        __dfc_sort_flush(child);
     }
     else
     {
-        SYS_FREE(sort);
+        child->batch.pending = true;
     }
 
+    SYS_UNLOCK(&child->lock);
+
+    return;
+
 failed:
+    // Keep the data and let the next addition retry the send.
+    child->batch.pending = true;
+
     SYS_UNLOCK(&child->lock);
 }
 
-SYS_LOCK_CREATE(dfc_sort_add, ((dfc_child_t *, child), (void *, data),
-                               (size_t, size)))
+void __dfc_sort_flush(dfc_child_t * child)
 {
-    dfc_sort_t * sort;
-    err_t error = ENOBUFS;
+    child->batch.pending = false;
+    child->batch.armed = false;
+    child->batch.gen++;
+    SYS_LOCK(&child->lock, dfc_sort_send, (child, &child->dfc->root_loc, 0,
+                                           child->seq));
+}
 
-    sort = child->sort;
-    if (sort != NULL)
+SYS_LOCK_CREATE(dfc_sort_flush, ((dfc_child_t *, child), (uint32_t, gen)))
+{
+    // The batch may have already been sent because a threshold was reached,
+    // or the child may have been destroyed.
+    if (child->batch.armed && (child->batch.gen == gen))
     {
-        error = SYS_CALL(
-                    sys_buf_set_block, (&sort->head, &sort->size, data, size),
-                    D()
-                );
+        __dfc_sort_flush(child);
     }
 
-    if (error != 0)
-    {
-        SYS_CALL(
-            dfc_sort_create, (&sort),
-            E(),
-            LOG(E(), "Cannot allocate buffers for DFC sort."),
-            GOTO(failed)
-        );
+    SYS_UNLOCK(&child->lock);
 
-        child->sort = sort;
+    dfc_child_put(child);
+}
 
-        SYS_CALL(
-            sys_buf_set_block, (&sort->head, &sort->size, data, size),
-            E(),
-            LOG(E(), "Cannot store data into DFC sort buffers."),
-            GOTO(failed)
-        );
-    }
+SYS_DELAY_CREATE(dfc_sort_window, ((dfc_child_t *, child), (uint32_t, gen)))
+{
+    SYS_LOCK(&child->lock, dfc_sort_flush, (child, gen));
+}
+
+SYS_LOCK_CREATE(dfc_sort_add, ((dfc_child_t *, child), (dfc_block_t *, block)))
+{
+    dfc_batching_t * batching;
+    dfc_batch_t * batch;
+    uint32_t delay;
+
+    batch = &child->batch;
+    SYS_CALL(
+        dfc_batch_add, (batch, block),
+        E(),
+        LOG(E(), "Cannot store data into DFC sort buffers."),
+        GOTO(failed)
+    );
+
+    batching = &child->dfc->batching;
+    dfc_batch_adapt(batching, batch, dfc_time());
 
-    if (sort->pending)
+    if (batch->pending)
     {
-        sort->pending = false;
-        SYS_LOCK(&child->lock, dfc_sort_send, (child, &child->dfc->root_loc, 0,
-                                               child->seq, sort));
+        delay = dfc_batch_window(batching, batch);
+        if ((delay == 0) ||
+            (batch->length >= SYS_MIN(batching->bytes, DFC_SORT_MAX)) ||
+            (batch->count >= batching->count))
+        {
+            __dfc_sort_flush(child);
+        }
+        else if (!batch->armed)
+        {
+            // Give other transactions the opportunity to join this send.
+            // The timer keeps a reference to the child.
+            batch->armed = true;
+            atomic_inc(&child->refs, memory_order_seq_cst);
+            SYS_DELAY(delay, dfc_sort_window, (child, batch->gen));
+        }
     }
 
+    SYS_UNLOCK(&child->lock);
+
+    return;
+
 failed:
+    dfc_block_put(block);
+
     SYS_UNLOCK(&child->lock);
 }
 
-void dfc_request_send(dfc_t * dfc, uint64_t mask, void * data, size_t size)
+void dfc_request_send(dfc_t * dfc, const uint64_t * mask, dfc_block_t * block)
 {
     dfc_child_t * child;
 
+    // All children share the same block. Each pending send keeps its own
+    // reference.
     list_for_each_entry(child, &dfc->children, list)
     {
-        if ((mask & 1) != 0)
+        if (dfc_mask_test(mask, child->idx))
         {
-            SYS_LOCK(&child->lock, dfc_sort_add, (child, data, size));
+            DFC_PROBE(request_send, child->idx, block->value->data,
+                      block->size);
+            atomic_inc(&block->refs, memory_order_seq_cst);
+            SYS_LOCK(&child->lock, dfc_sort_add, (child, block));
         }
+    }
+}
+
+void dfc_child_put(dfc_child_t * child)
+{
+    if (atomic_dec(&child->refs, memory_order_seq_cst) == 1)
+    {
+        dfc_batch_destroy(&child->batch);
 
-        mask >>= 1;
+        SYS_FREE(child);
     }
 }
 
@@ -730,7 +2159,11 @@ void dfc_child_destroy(dfc_child_t * child)
         ASSERT("There are DFC requests being processed")
     );
 
-    SYS_FREE(child);
+    // A pending batching timer will find the batch disarmed and only
+    // release its reference.
+    atomic_store(&child->batch.armed, false, memory_order_seq_cst);
+
+    dfc_child_put(child);
 }
 
 err_t dfc_child_create(dfc_t * dfc, xlator_t * xl, dfc_child_t ** child)
@@ -752,10 +2185,29 @@ err_t dfc_child_create(dfc_t * dfc, xlator_t * xl, dfc_child_t ** child)
     tmp->seq = 0;
     tmp->idx = dfc->count;
     tmp->state = DFC_CHILD_DOWN;
+    tmp->state_since = dfc_time();
+    memset(tmp->state_time, 0, sizeof(tmp->state_time));
+    tmp->pool_hits = 0;
+    tmp->pool_misses = 0;
+    tmp->bytes_sent = 0;
+    tmp->bytes_received = 0;
+    tmp->waiting = 0;
     INIT_LIST_HEAD(&tmp->list);
     INIT_LIST_HEAD(&tmp->pool);
-
-    tmp->sort = NULL;
+    uuid_clear(tmp->process);
+    tmp->brick = -1;
+    tmp->leader = NULL;
+    tmp->polls = dfc->requests;
+    tmp->features = 0;
+    tmp->rtt = 0;
+    tmp->gap = 0;
+    tmp->last = 0;
+    tmp->refs = 1;
+
+    // The batching window starts fully open. It is closed if sort data
+    // arrives too sparsely to be batched.
+    dfc_batch_initialize(&tmp->batch);
+    tmp->batch.window = dfc->batching.delay;
 
     *child = tmp;
 
@@ -765,6 +2217,9 @@ err_t dfc_child_create(dfc_t * dfc, xlator_t * xl, dfc_child_t ** child)
 void dfc_destroy(dfc_t * dfc)
 {
     dfc_child_t * child;
+    dfc_segment_t * segment;
+    dfc_cache_t * cache;
+    int64_t i;
 
     if (dfc->root_frame != NULL)
     {
@@ -780,11 +2235,51 @@ void dfc_destroy(dfc_t * dfc)
 
         dfc_child_destroy(child);
     }
+    if (dfc->child_index != NULL)
+    {
+        SYS_FREE(dfc->child_index);
+    }
+
+    while (!list_empty(&dfc->segments))
+    {
+        segment = list_entry(dfc->segments.next, dfc_segment_t, list);
+        list_del_init(&segment->list);
+
+        SYS_FREE(segment);
+    }
+
+    // Caches of threads still alive are emptied here. Each thread releases
+    // its own one when it terminates or creates a new cache.
+    pthread_mutex_lock(&dfc_cache_global);
+
+    while (!list_empty(&dfc->caches))
+    {
+        cache = list_entry(dfc->caches.next, dfc_cache_t, list);
+        list_del_init(&cache->list);
+
+        dfc_cache_release(cache);
+        cache->dfc = NULL;
+    }
+
+    pthread_mutex_unlock(&dfc_cache_global);
+
+    dfc_cache_release(&dfc->depot);
 
+    sys_mutex_terminate(&dfc->cache_lock);
+    sys_mutex_terminate(&dfc->segment_lock);
+    sys_mutex_terminate(&dfc->txn_lock);
     sys_mutex_terminate(&dfc->lock);
 
     if (dfc->txns != NULL)
     {
+        for (i = 0; i <= dfc->txn_mask; i++)
+        {
+            sys_mutex_terminate(&dfc->txns[i].lock);
+            if (dfc->txns[i].slots != NULL)
+            {
+                SYS_FREE(dfc->txns[i].slots);
+            }
+        }
         SYS_FREE(dfc->txns);
     }
     SYS_FREE(dfc);
@@ -807,6 +2302,9 @@ err_t dfc_create(xlator_t * xl, uint32_t max_requests, uint32_t requests,
     );
 
     sys_mutex_initialize(&tmp->lock);
+    sys_mutex_initialize(&tmp->txn_lock);
+    sys_mutex_initialize(&tmp->segment_lock);
+    sys_mutex_initialize(&tmp->cache_lock);
 
     tmp->xl = xl;
     memset(&tmp->root_loc, 0, sizeof(tmp->root_loc));
@@ -820,7 +2318,39 @@ err_t dfc_create(xlator_t * xl, uint32_t max_requests, uint32_t requests,
     uuid_generate(tmp->uuid);
     tmp->root_frame = NULL;
     tmp->txns = NULL;
+    tmp->child_index = NULL;
     tmp->notify = notify;
+    tmp->segment_count = 0;
+    tmp->segment_max = max_requests * 4;
+    INIT_LIST_HEAD(&tmp->segments);
+    tmp->batching.bytes = DFC_BATCH_BYTES;
+    tmp->batching.count = DFC_BATCH_COUNT;
+    tmp->batching.delay = DFC_BATCH_DELAY;
+    tmp->batching.adaptive = true;
+    tmp->features = DFC_FEATURE_MUX;
+    INIT_LIST_HEAD(&tmp->caches);
+    dfc_cache_initialize(&tmp->depot, tmp);
+    tmp->cache_max = max_requests * 4;
+
+    // The key is never deleted. Threads may still hold caches of already
+    // destroyed dfc_t.
+    pthread_mutex_lock(&dfc_cache_global);
+
+    error = 0;
+    if (!dfc_cache_key_ready)
+    {
+        error = pthread_key_create(&dfc_cache_key, dfc_cache_destroy);
+        dfc_cache_key_ready = (error == 0);
+    }
+
+    pthread_mutex_unlock(&dfc_cache_global);
+
+    SYS_TEST(
+        error == 0,
+        error,
+        E(),
+        GOTO(failed, &error)
+    );
 
     SYS_PTR(
         &tmp->root_frame, create_frame, (xl, xl->ctx->pool),
@@ -830,16 +2360,26 @@ err_t dfc_create(xlator_t * xl, uint32_t max_requests, uint32_t requests,
     );
 
     SYS_CALLOC(
-        &tmp->txns, 1024, gfdfc_mt_dfc_transaction_t,
+        &tmp->txns, DFC_TXN_STRIPES, gfdfc_mt_dfc_stripe_t,
         E(),
         GOTO(failed, &error)
     );
-    for (i = 0; i < 1024; i++)
+    for (i = 0; i < DFC_TXN_STRIPES; i++)
+    {
+        sys_mutex_initialize(&tmp->txns[i].lock);
+    }
+    tmp->txn_mask = DFC_TXN_STRIPES - 1;
+    for (i = 0; i < DFC_TXN_STRIPES; i++)
     {
-        INIT_LIST_HEAD(&tmp->txns[i]);
+        SYS_CALLOC(
+            &tmp->txns[i].slots, DFC_TXN_SLOTS, gfdfc_mt_dfc_stripe_t,
+            E(),
+            GOTO(failed, &error)
+        );
+        tmp->txns[i].size = DFC_TXN_SLOTS;
     }
-    tmp->txn_mask = 1023;
     tmp->current_txn = 0;
+    tmp->waiting = 0;
 
     tmp->count = 0;
     for (list = xl->children; list != NULL; list = list->next)
@@ -864,6 +2404,17 @@ err_t dfc_create(xlator_t * xl, uint32_t max_requests, uint32_t requests,
             list_add_tail(&req->list, &child->pool);
         }
     }
+    tmp->words = SYS_MAX(DFC_MASK_WORDS(tmp->count), 1);
+
+    SYS_CALLOC(
+        &tmp->child_index, SYS_MAX(tmp->count, 1), gfdfc_mt_dfc_child_index_t,
+        E(),
+        GOTO(failed, &error)
+    );
+    list_for_each_entry(child, &tmp->children, list)
+    {
+        tmp->child_index[child->idx] = child;
+    }
 
     *dfc = tmp;
 
@@ -908,6 +2459,36 @@ void dfc_terminate(dfc_t * dfc)
     dfc_destroy(dfc);
 }
 
+void dfc_set_batching(dfc_t * dfc, uint32_t bytes, uint32_t count,
+                      uint32_t delay, bool adaptive)
+{
+    dfc_child_t * child;
+
+    dfc->batching.bytes = bytes;
+    dfc->batching.count = count;
+    dfc->batching.delay = delay;
+    dfc->batching.adaptive = adaptive;
+
+    list_for_each_entry(child, &dfc->children, list)
+    {
+        child->batch.window = delay;
+    }
+}
+
+// Must be called before starting any child. Consumers that enable it need to
+// pass the replies of all fops to dfc_reply().
+void dfc_set_piggyback(dfc_t * dfc, bool enabled)
+{
+    if (enabled)
+    {
+        dfc->features |= DFC_FEATURE_PIGGYBACK;
+    }
+    else
+    {
+        dfc->features &= ~DFC_FEATURE_PIGGYBACK;
+    }
+}
+
 SYS_DELAY_CREATE(dfc_start_delayed, ((dfc_t *, dfc), (dfc_child_t *, child)))
 {
     sys_mutex_lock(&dfc->lock);
@@ -915,21 +2496,96 @@ SYS_DELAY_CREATE(dfc_start_delayed, ((dfc_t *, dfc), (dfc_child_t *, child)))
     if (child->state == DFC_CHILD_PREPARING)
     {
         dfc->active++;
-        child->state = DFC_CHILD_UP;
+        __dfc_child_state(child, DFC_CHILD_UP);
         dfc->notify(dfc, child->xl, DFC_CHILD_UP);
     }
     else if (child->state == DFC_CHILD_STOPPING)
     {
-        child->state = DFC_CHILD_DOWN;
+        __dfc_child_state(child, DFC_CHILD_DOWN);
     }
 
     sys_mutex_unlock(&dfc->lock);
 }
 
+// Checks if the brick of a child lives in the same process as another one
+// already started. In that case, the sort channel of that child is shared.
+void __dfc_child_join(dfc_t * dfc, dfc_child_t * child, dict_t * xdata)
+{
+    uint8_t info[sizeof(uuid_t) + sizeof(int64_t)];
+    dfc_child_t * tmp;
+    void * ptr;
+    size_t len;
+
+    child->leader = NULL;
+    uuid_clear(child->process);
+
+    len = sizeof(info);
+    if ((xdata == NULL) ||
+        (sys_dict_get_bin(xdata, DFC_XATTR_PROCESS, info, &len) != 0) ||
+        (len != sizeof(info)))
+    {
+        // The server does not support multiplexed sort channels.
+        return;
+    }
+    ptr = info;
+    uuid_copy(child->process, *__sys_buf_ptr_uuid(&ptr));
+    child->brick = __sys_buf_get_int64(&ptr);
+
+    child->leader = child;
+    list_for_each_entry(tmp, &dfc->children, list)
+    {
+        if ((tmp != child) && (tmp->leader == tmp) &&
+            ((tmp->state == DFC_CHILD_PREPARING) ||
+             (tmp->state == DFC_CHILD_UP)) &&
+            (uuid_compare(tmp->process, child->process) == 0))
+        {
+            child->leader = tmp;
+
+            break;
+        }
+    }
+}
+
+// If the child was the leader of a multiplexed channel, another child of the
+// same process takes its place.
+void __dfc_child_leave(dfc_t * dfc, dfc_child_t * child)
+{
+    dfc_child_t * tmp, * leader;
+    int32_t i;
+
+    if (child->leader != child)
+    {
+        child->leader = NULL;
+
+        return;
+    }
+    child->leader = NULL;
+
+    leader = NULL;
+    list_for_each_entry(tmp, &dfc->children, list)
+    {
+        if (tmp->leader == child)
+        {
+            if (leader == NULL)
+            {
+                leader = tmp;
+                for (i = 0; i < tmp->polls; i++)
+                {
+                    SYS_CALL(
+                        __dfc_sort_send, (tmp, &dfc->root_loc, 0, tmp->seq,
+                                          NULL),
+                        E()
+                    );
+                }
+            }
+            tmp->leader = leader;
+        }
+    }
+}
+
 SYS_CBK_CREATE(__dfc_start_cbk, io, ((dfc_t *, dfc), (dfc_child_t *, child)))
 {
     SYS_GF_WIND_CBK_TYPE(lookup) * args;
-    dfc_sort_t sort;
     int32_t i;
 
     args = (SYS_GF_WIND_CBK_TYPE(lookup) *)io;
@@ -940,28 +2596,50 @@ SYS_CBK_CREATE(__dfc_start_cbk, io, ((dfc_t *, dfc), (dfc_child_t *, child)))
     {
         if (args->op_ret == 0)
         {
-            child->state = DFC_CHILD_PREPARING;
-            dfc_sort_initialize(&sort);
-            for (i = 0; i < dfc->requests; i++)
+            __dfc_child_state(child, DFC_CHILD_PREPARING);
+            __dfc_child_join(dfc, child, args->xdata);
+
+            // Older servers do not advertise any feature.
+            child->features = 0;
+            sys_dict_del_uint64(&args->xdata, DFC_XATTR_FEATURES,
+                                &child->features);
+            if (dfc_child_is_leader(child))
             {
-                SYS_CALL(
-                    __dfc_sort_send, (child, &child->dfc->root_loc, 0,
-                                      child->seq, &sort),
-                    E()
-                );
+                for (i = 0; i < child->polls; i++)
+                {
+                    SYS_CALL(
+                        __dfc_sort_send, (child, &child->dfc->root_loc, 0,
+                                          child->seq, NULL),
+                        E()
+                    );
+                }
+            }
+            if ((args->xdata != NULL) &&
+                (dict_get(args->xdata, DFC_XATTR_READY) != NULL))
+            {
+                // The server has acknowledged the registration. Sort data
+                // generated before the polls arrive is kept by the server.
+                dfc->active++;
+                __dfc_child_state(child, DFC_CHILD_UP);
+                dfc->notify(dfc, child->xl, DFC_CHILD_UP);
+            }
+            else
+            {
+                // Older servers do not acknowledge the registration. Give
+                // them some time to process it.
+                SYS_DELAY(1000, dfc_start_delayed, (dfc, child));
             }
-            SYS_DELAY(1000, dfc_start_delayed, (dfc, child));
         }
         else
         {
             logW("Child '%s' failed to start", child->xl->name);
 
-            child->state = DFC_CHILD_FAILED;
+            __dfc_child_state(child, DFC_CHILD_FAILED);
         }
     }
     else if (child->state == DFC_CHILD_STOPPING)
     {
-        child->state = DFC_CHILD_DOWN;
+        __dfc_child_state(child, DFC_CHILD_DOWN);
     }
 
     sys_mutex_unlock(&dfc->lock);
@@ -969,9 +2647,10 @@ SYS_CBK_CREATE(__dfc_start_cbk, io, ((dfc_t *, dfc), (dfc_child_t *, child)))
 
 SYS_ASYNC_CREATE(__dfc_start, ((dfc_t *, dfc), (xlator_t *, xl)))
 {
-    dfc_sort_t sort;
+    uint8_t info[sizeof(int64_t) * 2];
     dfc_child_t * child;
     dict_t * xdata;
+    void * ptr;
 
     sys_mutex_lock(&dfc->lock);
 
@@ -981,16 +2660,38 @@ SYS_ASYNC_CREATE(__dfc_start, ((dfc_t *, dfc), (xlator_t *, xl)))
         {
             if (child->state == DFC_CHILD_DOWN)
             {
-                dfc_sort_initialize(&sort);
                 xdata = NULL;
                 SYS_CALL(
-                    __dfc_attach, (dfc, 0, child->seq, sort.data,
-                                   sizeof(sort.data) - sort.size, &xdata),
+                    dfc_batch_attach, (dfc, 0, child->seq, NULL, 0, &xdata),
                     E(),
                     LOG(E(), "Failed to prepare a DFC sort request."),
                     BREAK()
                 );
-                child->state = DFC_CHILD_STARTING;
+
+                // Let the server know where we are, so that it can keep the
+                // state of this client if it already knows it. Anything
+                // sent to this child before is either received or lost.
+                ptr = info;
+                sys_mutex_lock(&dfc->txn_lock);
+                __sys_buf_set_int64(&ptr, dfc->current_txn);
+                __sys_buf_set_int64(&ptr, child->seq);
+                sys_mutex_unlock(&dfc->txn_lock);
+                SYS_CALL(
+                    sys_dict_set_bin, (&xdata, DFC_XATTR_RESUME, info,
+                                       sizeof(info), NULL),
+                    E(),
+                    LOG(E(), "Failed to prepare a DFC sort request."),
+                    GOTO(failed_xdata)
+                );
+                SYS_CALL(
+                    sys_dict_set_uint64, (&xdata, DFC_XATTR_FEATURES,
+                                          dfc->features, NULL),
+                    E(),
+                    LOG(E(), "Failed to prepare a DFC sort request."),
+                    GOTO(failed_xdata)
+                );
+
+                __dfc_child_state(child, DFC_CHILD_STARTING);
 
                 SYS_IO(
                     sys_gf_lookup_wind, (dfc->root_frame, NULL, xl,
@@ -1005,6 +2706,13 @@ SYS_ASYNC_CREATE(__dfc_start, ((dfc_t *, dfc), (xlator_t *, xl)))
     }
 
     sys_mutex_unlock(&dfc->lock);
+
+    return;
+
+failed_xdata:
+    sys_dict_release(xdata);
+
+    sys_mutex_unlock(&dfc->lock);
 }
 
 void dfc_start(dfc_t * dfc, xlator_t * xl)
@@ -1024,17 +2732,19 @@ void dfc_stop(dfc_t * dfc, xlator_t * xl)
         {
             if (child->state == DFC_CHILD_UP)
             {
-                child->state = DFC_CHILD_DOWN;
+                __dfc_child_state(child, DFC_CHILD_DOWN);
+                __dfc_child_leave(dfc, child);
                 dfc->notify(dfc, child->xl, DFC_CHILD_DOWN);
             }
             else if ((child->state == DFC_CHILD_STARTING) ||
                      (child->state == DFC_CHILD_PREPARING))
             {
-                child->state = DFC_CHILD_STOPPING;
+                __dfc_child_state(child, DFC_CHILD_STOPPING);
+                __dfc_child_leave(dfc, child);
             }
             else if (child->state == DFC_CHILD_FAILED)
             {
-                child->state = DFC_CHILD_DOWN;
+                __dfc_child_state(child, DFC_CHILD_DOWN);
             }
             break;
         }
@@ -1062,8 +2772,8 @@ int32_t dfc_default_notify(dfc_t * dfc, xlator_t * xl, int32_t event,
     return 0;
 }
 
-err_t dfc_begin(dfc_t * dfc, uint64_t mask, inode_t * inode, dict_t * xdata,
-                dfc_transaction_t ** txn)
+err_t dfc_begin_mask(dfc_t * dfc, const uint64_t * mask, inode_t * inode,
+                     dict_t * xdata, dfc_transaction_t ** txn)
 {
     dfc_transaction_t * tmp;
 
@@ -1078,8 +2788,28 @@ err_t dfc_begin(dfc_t * dfc, uint64_t mask, inode_t * inode, dict_t * xdata,
     return 0;
 }
 
+// Only the first 64 children can be selected. dfc_begin_mask() must be used
+// to include the others.
+err_t dfc_begin(dfc_t * dfc, uint64_t mask, inode_t * inode, dict_t * xdata,
+                dfc_transaction_t ** txn)
+{
+    uint64_t words[dfc->words];
+
+    if (dfc->words == 1)
+    {
+        return dfc_begin_mask(dfc, &mask, inode, xdata, txn);
+    }
+
+    memset(words, 0, sizeof(words));
+    words[0] = mask;
+
+    return dfc_begin_mask(dfc, words, inode, xdata, txn);
+}
+
 err_t dfc_attach(dfc_transaction_t * txn, int32_t idx, dict_t ** xdata)
 {
+    uint8_t empty;
+
     if (txn != NULL)
     {
         SYS_CALL(
@@ -1087,6 +2817,15 @@ err_t dfc_attach(dfc_transaction_t * txn, int32_t idx, dict_t ** xdata)
             E(),
             RETERR()
         );
+
+        if (txn->complete)
+        {
+            SYS_CALL(
+                sys_dict_set_bin, (xdata, DFC_XATTR_DEPS, &empty, 0, NULL),
+                E(),
+                RETERR()
+            );
+        }
     }
 
     return 0;
@@ -1094,24 +2833,27 @@ err_t dfc_attach(dfc_transaction_t * txn, int32_t idx, dict_t ** xdata)
 
 bool dfc_failed(dfc_transaction_t * txn, int32_t count)
 {
-    uint32_t state;
+    uint64_t state;
 
     if (txn == NULL)
     {
         return true;
     }
-    state = count | (count << 16);
+    state = (uint64_t)count << DFC_STATE_SHIFT;
+    if (!txn->complete)
+    {
+        state |= count;
+    }
     state = atomic_sub_return(&txn->state, state, memory_order_seq_cst);
-    if ((state >> 16) == 0)
+    if ((state >> DFC_STATE_SHIFT) == 0)
     {
         dfc_transaction_destroy(txn);
 
         return true;
     }
-    if ((state & 0xFFFF) == 0)
+    if (!txn->complete && ((state & DFC_STATE_MASK) == 0))
     {
-        dfc_request_send(txn->dfc, txn->sorted, txn->sort.data,
-                         sizeof(txn->sort.data) - txn->sort.size);
+        dfc_transaction_send(txn);
     }
 
     return false;
@@ -1123,7 +2865,8 @@ bool dfc_complete(dfc_transaction_t * txn)
     {
         return true;
     }
-    if ((atomic_sub(&txn->state, 0x10000, memory_order_seq_cst) >> 16) == 1)
+    if ((atomic_sub(&txn->state, 1ULL << DFC_STATE_SHIFT,
+                    memory_order_seq_cst) >> DFC_STATE_SHIFT) == 1)
     {
         dfc_transaction_destroy(txn);
 
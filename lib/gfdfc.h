@@ -21,11 +21,29 @@
 #ifndef __GFDFC_H__
 #define __GFDFC_H__
 
-#define DFC_XATTR_UUID   "trusted.dfc.uuid"
-#define DFC_XATTR_ID     "trusted.dfc.id"
-#define DFC_XATTR_SORT   "trusted.dfc.sort"
-#define DFC_XATTR_OFFSET "trusted.dfc.offset"
-#define DFC_XATTR_SIZE   "trusted.dfc.size"
+#define DFC_XATTR_UUID    "trusted.dfc.uuid"
+#define DFC_XATTR_ID      "trusted.dfc.id"
+#define DFC_XATTR_SORT    "trusted.dfc.sort"
+#define DFC_XATTR_DEPS    "trusted.dfc.deps"
+#define DFC_XATTR_MUX     "trusted.dfc.mux"
+#define DFC_XATTR_PROCESS "trusted.dfc.process"
+#define DFC_XATTR_READY   "trusted.dfc.ready"
+#define DFC_XATTR_RESUME  "trusted.dfc.resume"
+#define DFC_XATTR_PARKED  "trusted.dfc.parked"
+#define DFC_XATTR_FEATURES "trusted.dfc.features"
+#define DFC_XATTR_STATS   "trusted.dfc.stats"
+#define DFC_XATTR_TRACE   "trusted.dfc.trace"
+#define DFC_XATTR_OFFSET  "trusted.dfc.offset"
+#define DFC_XATTR_SIZE    "trusted.dfc.size"
+
+// Optional behaviours negotiated on registration. Each side only advertises
+// its own ones.
+// The client takes sort data from fop replies (see dfc_reply()).
+#define DFC_FEATURE_PIGGYBACK 0x01
+// The server accepts DFC_XATTR_DEPS on single-child transactions.
+#define DFC_FEATURE_DEPS      0x02
+// The client polls a single sort channel for all bricks of a process.
+#define DFC_FEATURE_MUX       0x04
 
 #define DFC_CHILD_DOWN      0
 #define DFC_CHILD_STARTING  1
@@ -33,28 +51,134 @@
 #define DFC_CHILD_STOPPING  3
 #define DFC_CHILD_UP        4
 #define DFC_CHILD_FAILED    5
+#define DFC_CHILD_STATES    6
+
+#define DFC_SEGMENT_SIZE     1024
+
+// Space needed to frame a block of sort data.
+#define DFC_BLOCK_OVERHEAD   16
+
+// Sort data sent in a single request never exceeds this size, unless a
+// single block is bigger. Must match the server.
+#define DFC_SORT_MAX         65536
+
+#define DFC_BATCH_BYTES    16384
+#define DFC_BATCH_COUNT    64
+#define DFC_BATCH_DELAY    1
+
+#define DFC_MASK_BITS      64
+#define DFC_MASK_WORDS(_n) (((_n) + DFC_MASK_BITS - 1) / DFC_MASK_BITS)
+#define DFC_MASK_COUNT     5
+
+// Root transaction ids advance by 1 << DFC_TXN_SHIFT. Ids in between are used
+// by subtransactions. Must match the server.
+#define DFC_TXN_SHIFT      16
+#define DFC_TXN_SUBTXNS    ((1LL << DFC_TXN_SHIFT) - 1)
+
+// The state of a transaction keeps the number of pending sorts in the low
+// half and the number of pending completions in the high half.
+#define DFC_STATE_SHIFT    32
+#define DFC_STATE_MASK     0xFFFFFFFFULL
+
+#define DFC_TXN_STRIPES    64
+#define DFC_TXN_SLOTS      64
+
+#define DFC_CACHE_SIZE     32
+#define DFC_CACHE_TXN      0
+#define DFC_CACHE_REQ      1
+#define DFC_CACHE_BINS     2
+
+struct _dfc_segment;
+typedef struct _dfc_segment dfc_segment_t;
 
 struct _dfc_sort;
 typedef struct _dfc_sort dfc_sort_t;
 
+struct _dfc_block;
+typedef struct _dfc_block dfc_block_t;
+
+struct _dfc_batch;
+typedef struct _dfc_batch dfc_batch_t;
+
+struct _dfc_batching;
+typedef struct _dfc_batching dfc_batching_t;
+
 struct _dfc_request;
 typedef struct _dfc_request dfc_request_t;
 
 struct _dfc_transaction;
 typedef struct _dfc_transaction dfc_transaction_t;
 
+struct _dfc_stripe;
+typedef struct _dfc_stripe dfc_stripe_t;
+
+struct _dfc_bin;
+typedef struct _dfc_bin dfc_bin_t;
+
+struct _dfc_cache;
+typedef struct _dfc_cache dfc_cache_t;
+
 struct _dfc_child;
 typedef struct _dfc_child dfc_child_t;
 
+struct _dfc_child_metrics;
+typedef struct _dfc_child_metrics dfc_child_metrics_t;
+
+struct _dfc_metrics;
+typedef struct _dfc_metrics dfc_metrics_t;
+
 struct _dfc;
 typedef struct _dfc dfc_t;
 
+struct _dfc_segment
+{
+    struct list_head list;
+    void *           head;
+    size_t           size;
+    size_t           length;
+    uint8_t          data[];
+};
+
 struct _dfc_sort
 {
-    void *  head;
-    size_t  size;
-    bool    pending;
-    uint8_t data[4096];
+    struct list_head segments;
+    size_t           length;
+    bool             pending;
+};
+
+// Immutable sort data shared by all children that need to receive it. It is
+// stored already framed into a dict value, so a request carrying only this
+// block references it instead of copying it.
+struct _dfc_block
+{
+    uint32_t refs;
+    uint32_t size;
+    data_t * value;
+};
+
+// List of shared blocks pending to be sent to a child.
+struct _dfc_batch
+{
+    dfc_block_t ** blocks;
+    uint32_t       count;
+    uint32_t       max;
+    size_t         length;
+    uint32_t       window;
+    uint64_t       last;
+    uint32_t       gen;
+    bool           armed;
+    bool           pending;
+};
+
+// Limits of the sort batching window. Accumulated data is sent as soon as
+// 'bytes' or 'count' is reached, or after 'delay' milliseconds. In adaptive
+// mode, 'delay' is the maximum window.
+struct _dfc_batching
+{
+    uint32_t bytes;
+    uint32_t count;
+    uint32_t delay;
+    bool     adaptive;
 };
 
 struct _dfc_request
@@ -62,7 +186,7 @@ struct _dfc_request
     struct list_head list;
     dfc_child_t *    child;
     call_frame_t *   frame;
-    dfc_sort_t       sort;
+    uint64_t         sent;
 };
 
 struct _dfc_transaction
@@ -70,32 +194,118 @@ struct _dfc_transaction
     sys_mutex_t         lock;
     struct list_head    list;
     dfc_transaction_t * root;
+    // Held by the owner, by index lookups and by each subtransaction.
+    uint32_t            refs;
     int64_t             id;
     int64_t             subtxn;
     dfc_t *             dfc;
-    uint64_t            group;
-    uint64_t            sorted;
-    uint64_t            mask;
-    uint64_t            extra;
-    uint32_t            state;
+    // Sets of children of dfc->words words each, stored after 'seqs'.
+    uint64_t *          group;
+    uint64_t *          sorted;
+    uint64_t *          mask;
+    uint64_t *          extra;
+    uint64_t *          bits;
+    uint64_t            state;
+    bool                complete;
+    // Children whose sort data is still expected.
+    uint32_t            waiting;
     inode_t *           inode;
     dfc_sort_t          sort;
+    uint8_t             header[sizeof(int64_t)];
     uint64_t            seqs[];
 };
 
+// Part of the transaction index. Each stripe is an open addressing hash table
+// protected by its own lock, so that lookups and insertions of unrelated
+// transactions do not contend. It grows and shrinks with the number of
+// transactions in flight.
+struct _dfc_stripe
+{
+    sys_mutex_t          lock;
+    dfc_transaction_t ** slots;
+    uint32_t             size;
+    uint32_t             count;
+};
+
+// Released transactions and requests ready to be reused. Each thread keeps
+// its own cache. A shared one in dfc_t is used to balance them.
+struct _dfc_bin
+{
+    struct list_head items;
+    uint32_t         count;
+};
+
+// 'next' chains the caches of the same thread, one for each dfc_t it uses.
+// 'dfc' is cleared when the dfc_t is destroyed before the thread.
+struct _dfc_cache
+{
+    struct list_head list;
+    dfc_cache_t *    next;
+    dfc_t *          dfc;
+    dfc_bin_t        bins[DFC_CACHE_BINS];
+};
+
 struct _dfc_child
 {
     sys_lock_t       lock;
     struct list_head list;
     dfc_t *          dfc;
     xlator_t *       xl;
+    uint32_t         refs;
     int64_t          seq;
     int32_t          idx;
     int32_t          state;
     uint32_t         count;
     uint32_t         active;
     struct list_head pool;
-    dfc_sort_t *     sort;
+    dfc_batch_t      batch;
+    uuid_t           process;
+    int64_t          brick;
+    dfc_child_t *    leader;
+    uint32_t         polls;
+    uint64_t         features;
+    uint64_t         rtt;
+    uint64_t         gap;
+    uint64_t         last;
+    uint64_t         pool_hits;
+    uint64_t         pool_misses;
+    uint64_t         bytes_sent;
+    uint64_t         bytes_received;
+    // Transactions that still need sort data from this child.
+    uint64_t         waiting;
+    uint64_t         state_since;
+    uint64_t         state_time[DFC_CHILD_STATES];
+};
+
+// Activity of a child. Times are in microseconds. 'active' is the number of
+// outstanding sort requests and 'waiting' the number of transactions that
+// still need sort data from the child.
+struct _dfc_child_metrics
+{
+    int32_t  state;
+    uint32_t active;
+    uint32_t polls;
+    uint64_t rtt;
+    uint64_t pool_hits;
+    uint64_t pool_misses;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
+    uint64_t waiting;
+    uint64_t state_time[DFC_CHILD_STATES];
+};
+
+// Totals of all children. 'waiting' counts each transaction once.
+struct _dfc_metrics
+{
+    uint32_t children;
+    uint32_t active;
+    uint32_t polls;
+    uint32_t transactions;
+    uint64_t waiting;
+    uint64_t pool_hits;
+    uint64_t pool_misses;
+    uint64_t bytes_sent;
+    uint64_t bytes_received;
 };
 
 struct _dfc
@@ -104,14 +314,29 @@ struct _dfc
     uuid_t             uuid;
     xlator_t *         xl;
     loc_t              root_loc;
+    sys_mutex_t        txn_lock;
     int64_t            current_txn;
     int64_t            txn_mask;
     uint32_t           max_requests;
     uint32_t           requests;
     uint32_t           count;
+    uint32_t           words;
     uint32_t           active;
+    // Transactions that still need sort data from any child.
+    uint64_t           waiting;
     struct list_head   children;
-    struct list_head * txns;
+    dfc_child_t **     child_index;
+    dfc_stripe_t *     txns;
+    sys_mutex_t        segment_lock;
+    uint32_t           segment_count;
+    uint32_t           segment_max;
+    struct list_head   segments;
+    sys_mutex_t        cache_lock;
+    uint32_t           cache_max;
+    struct list_head   caches;
+    dfc_cache_t        depot;
+    dfc_batching_t     batching;
+    uint64_t           features;
     call_frame_t *     root_frame;
     void            (* notify)(dfc_t *, xlator_t *, int32_t);
 };
@@ -122,21 +347,38 @@ enum gfdfc_mem_types
     gfdfc_mt_dfc_child_t,
     gfdfc_mt_dfc_transaction_t,
     gfdfc_mt_dfc_request_t,
-    gfdfc_mt_dfc_sort_t
+    gfdfc_mt_dfc_sort_t,
+    gfdfc_mt_dfc_segment_t,
+    gfdfc_mt_dfc_block_t,
+    gfdfc_mt_dfc_batch_t,
+    gfdfc_mt_dfc_stripe_t,
+    gfdfc_mt_dfc_cache_t,
+    gfdfc_mt_dfc_child_index_t,
+    gfdfc_mt_dfc_child_metrics_t
 };
 
 err_t dfc_initialize(xlator_t * xl, uint32_t max_requests, uint32_t requests,
                      void (* notify)(dfc_t *, xlator_t *, int32_t),
                      dfc_t ** dfc);
 void dfc_terminate(dfc_t * dfc);
+void dfc_set_batching(dfc_t * dfc, uint32_t bytes, uint32_t count,
+                      uint32_t delay, bool adaptive);
+void dfc_set_piggyback(dfc_t * dfc, bool enabled);
 void dfc_start(dfc_t * dfc, xlator_t * xl);
 void dfc_stop(dfc_t * dfc, xlator_t * xl);
 int32_t dfc_default_notify(dfc_t * dfc, xlator_t * xl, int32_t event,
                            void * data);
 err_t dfc_begin(dfc_t * dfc, uint64_t mask, inode_t * inode, dict_t * xdata,
                 dfc_transaction_t ** txn);
+err_t dfc_begin_mask(dfc_t * dfc, const uint64_t * mask, inode_t * inode,
+                     dict_t * xdata, dfc_transaction_t ** txn);
 err_t dfc_attach(dfc_transaction_t * txn, int32_t idx, dict_t ** xdata);
+void dfc_reply(dfc_transaction_t * txn, int32_t idx, dict_t * xdata);
 bool dfc_failed(dfc_transaction_t * txn, int32_t count);
 bool dfc_complete(dfc_transaction_t * txn);
+void dfc_txn_occupancy(dfc_t * dfc, uint32_t * count, uint32_t * size);
+void dfc_metrics(dfc_t * dfc, dfc_metrics_t * metrics,
+                 dfc_child_metrics_t * children);
+void dfc_dump(dfc_t * dfc);
 
 #endif /* __GFDFC_H__ */
@@ -20,8 +20,24 @@
 
 #include "gfsys.h"
 
+#include "statedump.h"
+
 #include "dfc.h"
 
+// Static probes for tracing tools. They are compiled out when sys/sdt.h is
+// not available. Inodes are identified by a pointer to their gfid.
+#ifdef HAVE_SYS_SDT_H
+#include <sys/sdt.h>
+#define DFC_PROBE(_name, _args...) STAP_PROBEV(dfc, _name, ## _args)
+#else
+#define DFC_PROBE(_name, _args...) do { } while (0)
+#endif
+
+#define DFC_GFID(_inode) (((_inode) != NULL) ? (_inode)->gfid : NULL)
+
+struct _dfc_segment;
+typedef struct _dfc_segment dfc_segment_t;
+
 struct _dfc_sort;
 typedef struct _dfc_sort dfc_sort_t;
 
@@ -40,24 +56,54 @@ typedef struct _dfc_request dfc_request_t;
 struct _dfc_client;
 typedef struct _dfc_client dfc_client_t;
 
+struct _dfc_batching;
+typedef struct _dfc_batching dfc_batching_t;
+
+struct _dfc_channel;
+typedef struct _dfc_channel dfc_channel_t;
+
+struct _dfc_slot;
+typedef struct _dfc_slot dfc_slot_t;
+
+struct _dfc_event;
+typedef struct _dfc_event dfc_event_t;
+
+struct _dfc_thread;
+typedef struct _dfc_thread dfc_thread_t;
+
+struct _dfc_stats;
+typedef struct _dfc_stats dfc_stats_t;
+
 struct _dfc_manager;
 typedef struct _dfc_manager dfc_manager_t;
 
-struct _dfc_sort
+struct _dfc_segment
 {
     struct list_head list;
     void *           head;
     size_t           size;
+    size_t           length;
+    uint8_t          data[];
+};
+
+struct _dfc_sort
+{
+    struct list_head list;
+    dfc_manager_t *  dfc;
+    struct list_head segments;
+    size_t           length;
+    uint32_t         count;
     bool             pending;
-    uint8_t          data[4096];
 };
 
 struct _dfc_dependencies
 {
-    void *  buffer;
-    void *  head;
-    size_t  size;
-    uint8_t data[256];
+    void *    buffer;
+    void *    head;
+    size_t    size;
+    size_t    length;
+    uint8_t * data;
+    uint8_t   storage[256];
 };
 
 struct _dfc_link
@@ -91,6 +137,11 @@ struct _dfc_request
     dfc_client_t *   client;
     int64_t          txn;
     int64_t          seq;
+    int32_t          fop;
+    uint64_t         time_arrival;
+    uint64_t         time_sorted;
+    uint64_t         time_ready;
+    uint64_t         time_wind;
     dfc_link_t       link1;
     dfc_link_t       link2;
     void *           sort;
@@ -111,6 +162,7 @@ struct _dfc_request
     bool             started;
     bool             completed;
     bool             fake;
+    bool             complete;
 };
 
 struct _dfc_client
@@ -119,10 +171,24 @@ struct _dfc_client
     sys_lock_t       lock;
     dfc_client_t *   next;
     dfc_manager_t *  dfc;
+    // Short identifier used in traces.
+    uint32_t         index;
     int64_t          next_receive;
     int64_t          next_txn;
     int64_t          next_seq;
+    int64_t          resume_txn;
+    int64_t          resume_seq;
+    time_t           last;
     dfc_sort_t *     sort;
+    dfc_sort_t *     ready;
+    dfc_channel_t *  channel;
+    uint32_t         executing;
+    uint32_t         slots;
+    uint32_t         batch_window;
+    uint64_t         batch_last;
+    uint32_t         batch_gen;
+    bool             batch_armed;
+    uint64_t         features;
     uint32_t         refs;
     uint32_t         txn_mask;
     struct list_head * requests;
@@ -131,14 +197,343 @@ struct _dfc_client
     struct list_head sort_pending;
 };
 
+// Limits of the sort batching window. Accumulated data is sent as soon as
+// 'bytes' or 'count' is reached, or after 'delay' milliseconds. In adaptive
+// mode, 'delay' is the maximum window.
+struct _dfc_batching
+{
+    uint32_t     bytes;
+    uint32_t     count;
+    uint32_t     delay;
+    gf_boolean_t adaptive;
+};
+
+// Sort channel shared by all bricks of the process for a given client.
+struct _dfc_channel
+{
+    struct list_head list;
+    sys_lock_t       lock;
+    uuid_t           uuid;
+    // Time of the last poll. Bricks that do not receive the polls use it to
+    // know that the client is still connected.
+    time_t           last;
+    struct list_head slots;
+    uint32_t         parked;
+    struct list_head pending;
+};
+
+struct _dfc_slot
+{
+    struct list_head list;
+    dfc_channel_t *  channel;
+    call_frame_t *   frame;
+};
+
+// Latency histograms of managed fops, in microseconds. Bucket 0 counts times
+// below 1 us and bucket i times in [2^(i-1), 2^i). Each thread updates its
+// own copy, so readers never block the I/O path.
+#define DFC_LATENCY_BUCKETS 32
+#define DFC_LATENCY_SORT    0
+#define DFC_LATENCY_DEPS    1
+#define DFC_LATENCY_EXEC    2
+#define DFC_LATENCY_COUNT   3
+
+// Ordering events kept in the trace of each thread. The trace is a ring that
+// only its thread writes. Readers copy it and discard the entries that may
+// have been overwritten meanwhile.
+#define DFC_EVENT_ADMIT     0
+#define DFC_EVENT_SORT      1
+#define DFC_EVENT_DEPEND    2
+#define DFC_EVENT_CYCLE     3
+#define DFC_EVENT_TIMEOUT   4
+#define DFC_EVENT_EXECUTE   5
+#define DFC_EVENT_BAD       6
+#define DFC_EVENT_COMPLETE  7
+#define DFC_EVENT_COUNT     8
+
+#define DFC_TRACE_SIZE      256
+
+// Maximum number of events returned through DFC_XATTR_TRACE.
+#define DFC_TRACE_XATTR     512
+
+struct _dfc_event
+{
+    uint64_t time;
+    int64_t  txn;
+    int64_t  seq;
+    uuid_t   gfid;
+    // -1 for requests not associated to a client.
+    int32_t  client;
+    uint32_t brick;
+    uint32_t type;
+};
+
+// Data owned by each thread that processes requests. It is shared by all
+// bricks of the process, so events record their brick.
+struct _dfc_thread
+{
+    struct list_head list;
+    uint64_t         hist[GF_FOP_MAXVALUE][DFC_LATENCY_COUNT]
+                         [DFC_LATENCY_BUCKETS];
+    uint64_t         head;
+    dfc_event_t      trace[DFC_TRACE_SIZE];
+};
+
+// Counters reported through DFC_XATTR_STATS. They are updated atomically
+// without taking any lock.
+struct _dfc_stats
+{
+    uint64_t admitted;
+    uint64_t bypassed;
+    uint64_t timed_out;
+    uint64_t cycles;
+    uint64_t bad;
+    uint64_t sort_in;
+    uint64_t sort_out;
+    uint64_t inodes;
+};
+
 struct _dfc_manager
 {
-    sys_lock_t     lock;
-    uint64_t       graph;
-    dfc_client_t * clients[256];
+    struct list_head list;
+    sys_lock_t       lock;
+    uint64_t         graph;
+    uint32_t         brick;
+    // Released by fini and by each pending purge of the sort channels.
+    uint32_t         refs;
+    gf_lock_t        segment_lock;
+    uint32_t         segment_count;
+    struct list_head segments;
+    dfc_batching_t   batching;
+    uint32_t         idle_timeout;
+    uint32_t         max_clients;
+    uint32_t         client_count;
+    time_t           last_sweep;
+    dfc_stats_t      stats;
+    uint32_t         client_index;
+    dfc_client_t *   clients[256];
 };
 
 #define DFC_REQ_SIZE SYS_CALLS_ADJUST_SIZE(sizeof(dfc_request_t))
+#define DFC_SLOT_SIZE SYS_CALLS_ADJUST_SIZE(sizeof(dfc_slot_t))
+
+// Size of pooled sort segments. Blocks that do not fit into a segment get
+// a dedicated one that is not returned to the pool.
+#define DFC_SEGMENT_SIZE       1024
+#define DFC_SEGMENT_POOL       1024
+
+// Space needed to frame a block of sort data.
+#define DFC_BLOCK_OVERHEAD     16
+
+// Once a queued sort buffer reaches this size, new dependencies are stored
+// into a new one so that a single reply does not grow without limit. Must
+// match the client.
+#define DFC_SORT_MAX           65536
+
+// Time (in ms) that sort data waits to be attached to a fop reply before
+// being sent through a sort request.
+#define DFC_PIGGYBACK_DELAY    10
+
+// Minimum time (in seconds) between two searches of idle clients. When the
+// number of clients exceeds the configured maximum, clients idle for at
+// least DFC_CLIENT_MIN_IDLE seconds are also evicted. Connected clients
+// poll their sort channel much more often.
+#define DFC_SWEEP_INTERVAL     10
+#define DFC_CLIENT_MIN_IDLE    120
+
+// All DFC translators loaded in the same process share a process id and
+// the sort channels to each client.
+static pthread_mutex_t dfc_process_lock = PTHREAD_MUTEX_INITIALIZER;
+static uuid_t dfc_process_uuid;
+static uint32_t dfc_process_bricks = 0;
+static uint32_t dfc_process_count = 0;
+static struct list_head dfc_process_channels = { &dfc_process_channels,
+                                                 &dfc_process_channels };
+// Bricks currently loaded. The first one dumps the data of the process.
+static struct list_head dfc_process_managers = { &dfc_process_managers,
+                                                 &dfc_process_managers };
+
+// Per thread data is also shared by all bricks of the process. The key is
+// never deleted, so terminating threads do not depend on any brick.
+static pthread_mutex_t dfc_thread_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_key_t dfc_thread_key;
+static bool dfc_thread_ready = false;
+static struct list_head dfc_threads = { &dfc_threads, &dfc_threads };
+// Histograms of terminated threads.
+static uint64_t dfc_thread_retired[GF_FOP_MAXVALUE][DFC_LATENCY_COUNT]
+                                  [DFC_LATENCY_BUCKETS];
+
+void dfc_process_register(dfc_manager_t * dfc)
+{
+    pthread_mutex_lock(&dfc_process_lock);
+
+    if (dfc_process_count++ == 0)
+    {
+        uuid_generate(dfc_process_uuid);
+    }
+    dfc->brick = dfc_process_bricks++;
+    list_add_tail(&dfc->list, &dfc_process_managers);
+
+    pthread_mutex_unlock(&dfc_process_lock);
+}
+
+void dfc_sort_free(dfc_sort_t * sort);
+
+void dfc_manager_put(dfc_manager_t * dfc)
+{
+    dfc_segment_t * segment;
+
+    if (atomic_dec(&dfc->refs, memory_order_seq_cst) == 1)
+    {
+        while (!list_empty(&dfc->segments))
+        {
+            segment = list_entry(dfc->segments.next, dfc_segment_t, list);
+            list_del_init(&segment->list);
+
+            SYS_FREE(segment);
+        }
+        LOCK_DESTROY(&dfc->segment_lock);
+
+        SYS_FREE(dfc);
+    }
+}
+
+// Removes the sort data of a terminated brick from a channel. The last brick
+// of the process also answers the parked sort requests and releases the
+// channel.
+SYS_LOCK_CREATE(dfc_channel_purge, ((dfc_channel_t *, channel),
+                                    (dfc_manager_t *, dfc), (bool, last)))
+{
+    dfc_sort_t * sort, * tmp;
+    dfc_slot_t * slot;
+    bool busy;
+
+    list_for_each_entry_safe(sort, tmp, &channel->pending, list)
+    {
+        if (sort->dfc == dfc)
+        {
+            list_del_init(&sort->list);
+
+            dfc_sort_free(sort);
+        }
+    }
+
+    busy = false;
+    while (last && !list_empty(&channel->slots))
+    {
+        slot = list_entry(channel->slots.next, dfc_slot_t, list);
+        list_del_init(&slot->list);
+        channel->parked--;
+
+        if (sys_delay_cancel((uintptr_t *)slot, false))
+        {
+            SYS_IO(
+                sys_gf_getxattr_unwind_error, (slot->frame, ENOTCONN, NULL),
+                NULL
+            );
+        }
+        else
+        {
+            // The timeout is already running and will lock the channel.
+            busy = true;
+        }
+    }
+
+    SYS_UNLOCK(&channel->lock);
+
+    if (last)
+    {
+        if (busy)
+        {
+            // Keep the channel for the next brick loaded in the process.
+            pthread_mutex_lock(&dfc_process_lock);
+            list_add_tail(&channel->list, &dfc_process_channels);
+            pthread_mutex_unlock(&dfc_process_lock);
+        }
+        else
+        {
+            SYS_FREE(channel);
+        }
+    }
+
+    dfc_manager_put(dfc);
+}
+
+void dfc_process_unregister(dfc_manager_t * dfc)
+{
+    struct list_head list;
+    dfc_channel_t * channel, * tmp;
+    bool last;
+
+    INIT_LIST_HEAD(&list);
+
+    pthread_mutex_lock(&dfc_process_lock);
+
+    list_del_init(&dfc->list);
+    last = (--dfc_process_count == 0);
+    if (last)
+    {
+        list_splice_init(&dfc_process_channels, &list);
+    }
+    else
+    {
+        // Other bricks keep using the channels, but sort data of this one
+        // cannot remain there once it is destroyed.
+        list_for_each_entry(channel, &dfc_process_channels, list)
+        {
+            atomic_inc(&dfc->refs, memory_order_seq_cst);
+            SYS_LOCK(&channel->lock, dfc_channel_purge,
+                     (channel, dfc, false));
+        }
+    }
+
+    pthread_mutex_unlock(&dfc_process_lock);
+
+    list_for_each_entry_safe(channel, tmp, &list, list)
+    {
+        list_del_init(&channel->list);
+
+        atomic_inc(&dfc->refs, memory_order_seq_cst);
+        SYS_LOCK(&channel->lock, dfc_channel_purge, (channel, dfc, true));
+    }
+}
+
+err_t dfc_channel_get(uuid_t uuid, dfc_channel_t ** channel)
+{
+    dfc_channel_t * tmp;
+    err_t error = 0;
+
+    pthread_mutex_lock(&dfc_process_lock);
+
+    list_for_each_entry(tmp, &dfc_process_channels, list)
+    {
+        if (uuid_compare(tmp->uuid, uuid) == 0)
+        {
+            goto done;
+        }
+    }
+
+    SYS_MALLOC(
+        &tmp, dfc_mt_dfc_channel_t,
+        E(),
+        GOTO(done, &error)
+    );
+
+    sys_lock_initialize(&tmp->lock);
+    uuid_copy(tmp->uuid, uuid);
+    tmp->last = time(NULL);
+    INIT_LIST_HEAD(&tmp->slots);
+    tmp->parked = 0;
+    INIT_LIST_HEAD(&tmp->pending);
+    list_add_tail(&tmp->list, &dfc_process_channels);
+
+done:
+    pthread_mutex_unlock(&dfc_process_lock);
+
+    *channel = tmp;
+
+    return error;
+}
 
 err_t dfc_client_get(dfc_manager_t * dfc, uuid_t uuid, dfc_client_t ** client)
 {
@@ -151,16 +546,16 @@ err_t dfc_client_get(dfc_manager_t * dfc, uuid_t uuid, dfc_client_t ** client)
     {
         tmp = sys_rcu_dereference(tmp->next);
     }
-    if (tmp == NULL)
+    // A client whose last reference is gone is being destroyed.
+    if ((tmp == NULL) ||
+        !atomic_inc_not_zero(&tmp->refs, memory_order_seq_cst,
+                                         memory_order_seq_cst))
     {
-        return ENOENT;
-    }
+        sys_rcu_read_unlock();
 
-    if (atomic_inc_not_zero(&tmp->refs, memory_order_seq_cst,
-                                        memory_order_seq_cst))
-    {
-        *client = tmp;
+        return ENOENT;
     }
+    *client = tmp;
 
     sys_rcu_read_unlock();
 
@@ -168,14 +563,17 @@ err_t dfc_client_get(dfc_manager_t * dfc, uuid_t uuid, dfc_client_t ** client)
 }
 
 err_t __dfc_client_add(dfc_manager_t * dfc, uuid_t uuid, int64_t txn,
-                       dfc_client_t ** client)
+                       dfc_client_t ** client, bool * found)
 {
     dfc_client_t * tmp;
     err_t error;
     int32_t i;
 
+    *found = true;
     if (dfc_client_get(dfc, uuid, &tmp) != 0)
     {
+        *found = false;
+
         SYS_MALLOC(
             &tmp, dfc_mt_dfc_client_t,
             E(),
@@ -184,6 +582,7 @@ err_t __dfc_client_add(dfc_manager_t * dfc, uuid_t uuid, int64_t txn,
 
         uuid_copy(tmp->uuid, uuid);
         tmp->dfc = dfc;
+        tmp->index = dfc->client_index++;
         INIT_LIST_HEAD(&tmp->sequence);
         INIT_LIST_HEAD(&tmp->sort_slots);
         INIT_LIST_HEAD(&tmp->sort_pending);
@@ -199,16 +598,31 @@ err_t __dfc_client_add(dfc_manager_t * dfc, uuid_t uuid, int64_t txn,
         tmp->txn_mask = 1023;
         tmp->next_txn = 0;
         tmp->next_seq = 0;
+        tmp->resume_txn = 0;
+        tmp->resume_seq = 0;
         tmp->next_receive = 1;
+        tmp->last = time(NULL);
         tmp->refs = 2;
         tmp->sort = NULL;
+        tmp->ready = NULL;
+        tmp->channel = NULL;
+        tmp->executing = 0;
+        tmp->slots = 0;
+        // The batching window starts fully open.
+        tmp->batch_window = dfc->batching.delay;
+        tmp->batch_last = 0;
+        tmp->batch_gen = 0;
+        tmp->batch_armed = false;
+        tmp->features = 0;
 
         sys_lock_initialize(&tmp->lock);
 
         tmp->next = dfc->clients[uuid[0]];
 
         sys_rcu_assign_pointer(dfc->clients[uuid[0]], tmp);
+        dfc->client_count++;
     }
+    tmp->last = time(NULL);
 
     *client = tmp;
 
@@ -240,8 +654,8 @@ void dfc_client_put(dfc_client_t * client)
             }
         }
         SYS_TEST(
-            (i < 1024) || !list_empty(&client->sort_slots) ||
-            !list_empty(&client->sort_pending),
+            (i == 1024) && list_empty(&client->sort_slots) &&
+            list_empty(&client->sort_pending),
             EBUSY,
             E(),
             ASSERT("Client has pending work to do")
@@ -251,149 +665,1202 @@ void dfc_client_put(dfc_client_t * client)
     }
 }
 
-err_t __dfc_client_del(dfc_manager_t * dfc, uuid_t uuid)
+// A client is idle when it has nothing pending on this brick and it has not
+// been used for 'timeout' seconds, either directly or through the shared sort
+// channel. Must be called with the client locked.
+bool dfc_client_idle(dfc_client_t * client, time_t now, time_t timeout)
+{
+    return ((now - client->last) >= timeout) &&
+           ((client->channel == NULL) ||
+            ((now - client->channel->last) >= timeout)) &&
+           list_empty(&client->sequence) && list_empty(&client->sort_slots) &&
+           list_empty(&client->sort_pending) && (client->sort == NULL) &&
+           (client->ready == NULL);
+}
+
+SYS_LOCK_CREATE(dfc_client_unlink, ((dfc_manager_t *, dfc),
+                                    (dfc_client_t *, client)))
 {
-    dfc_client_t * client, ** pprev;
+    dfc_client_t ** pprev;
 
-    pprev = &dfc->clients[uuid[0]];
-    client = *pprev;
-    while (client != NULL)
+    pprev = &dfc->clients[client->uuid[0]];
+    while (*pprev != client)
     {
-        if (uuid_compare(client->uuid, uuid) == 0)
-        {
-            sys_rcu_assign_pointer(*pprev, client->next);
+        pprev = &(*pprev)->next;
+    }
+    sys_rcu_assign_pointer(*pprev, client->next);
+    dfc->client_count--;
 
-            dfc_client_put(client);
+    SYS_UNLOCK(&dfc->lock);
 
-            return 0;
-        }
-        pprev = &client->next;
-        client = *pprev;
+    SYS_RCU(dfc_client_destroy, (client));
+
+    dfc_manager_put(dfc);
+}
+
+// Only the reference of the client table and the one of the caller can
+// remain. Both are dropped at once, so that lookups cannot take a new one
+// while the client is being removed.
+SYS_LOCK_CREATE(dfc_client_evict, ((dfc_client_t *, client),
+                                   (time_t, timeout)))
+{
+    dfc_manager_t * dfc;
+
+    dfc = client->dfc;
+    if (dfc_client_idle(client, time(NULL), timeout) &&
+        atomic_cmpxchg(&client->refs, 2, 0, memory_order_seq_cst,
+                       memory_order_seq_cst))
+    {
+        logD("Evicting idle DFC client");
+
+        SYS_UNLOCK(&client->lock);
+
+        SYS_LOCK(&dfc->lock, dfc_client_unlink, (dfc, client));
     }
+    else
+    {
+        SYS_UNLOCK(&client->lock);
 
-    return ENOENT;
+        dfc_client_put(client);
+        dfc_manager_put(dfc);
+    }
 }
 
-void dfc_sort_initialize(dfc_sort_t * sort)
+// Looks for idle clients. They are checked again under their own lock
+// before being removed. Their memory is released through RCU once no reader
+// can see them.
+void __dfc_client_sweep(dfc_manager_t * dfc)
 {
-    sort->head = sort->data;
-    sort->size = sizeof(sort->data);
-    sort->pending = true;
+    dfc_client_t * client;
+    time_t now, timeout;
+    int32_t i;
+
+    now = time(NULL);
+    if (now - dfc->last_sweep < DFC_SWEEP_INTERVAL)
+    {
+        return;
+    }
+
+    timeout = dfc->idle_timeout;
+    if ((dfc->max_clients > 0) && (dfc->client_count >= dfc->max_clients) &&
+        ((timeout == 0) || (timeout > DFC_CLIENT_MIN_IDLE)))
+    {
+        timeout = DFC_CLIENT_MIN_IDLE;
+    }
+    if (timeout == 0)
+    {
+        return;
+    }
+    dfc->last_sweep = now;
+
+    for (i = 0; i < 256; i++)
+    {
+        for (client = dfc->clients[i]; client != NULL; client = client->next)
+        {
+            if (((now - client->last) >= timeout) && (client->refs == 1) &&
+                atomic_inc_not_zero(&client->refs, memory_order_seq_cst,
+                                                   memory_order_seq_cst))
+            {
+                atomic_inc(&dfc->refs, memory_order_seq_cst);
+                SYS_LOCK(&client->lock, dfc_client_evict, (client, timeout));
+            }
+        }
+    }
 }
 
-err_t dfc_sort_create(dfc_client_t * client)
+uint64_t dfc_time(void)
 {
-    SYS_MALLOC(
-        &client->sort, dfc_mt_dfc_sort_t,
-        E(),
-        RETERR()
-    );
+    struct timespec now;
 
-    dfc_sort_initialize(client->sort);
+    clock_gettime(CLOCK_MONOTONIC, &now);
 
-    return 0;
+    return now.tv_sec * 1000000ULL + now.tv_nsec / 1000;
 }
 
-err_t dfc_sort_unwind(call_frame_t * frame, dfc_sort_t * sort)
+// Called when a thread terminates. Its trace is lost.
+void dfc_thread_destroy(void * data)
 {
-    dict_t * xdata;
-    err_t error = 0;
+    dfc_thread_t * thread;
+    int32_t i, j, k;
 
-    xdata = NULL;
-    SYS_CALL(
-        sys_dict_set_bin, (&xdata, DFC_XATTR_SORT, sort->data,
-                           sizeof(sort->data) - sort->size, NULL),
-        E(),
-        GOTO(failed, &error)
-    );
+    thread = data;
 
-    SYS_IO(sys_gf_getxattr_unwind, (frame, 0, 0, xdata, NULL), NULL);
+    pthread_mutex_lock(&dfc_thread_lock);
+
+    list_del_init(&thread->list);
+    for (i = 0; i < GF_FOP_MAXVALUE; i++)
+    {
+        for (j = 0; j < DFC_LATENCY_COUNT; j++)
+        {
+            for (k = 0; k < DFC_LATENCY_BUCKETS; k++)
+            {
+                dfc_thread_retired[i][j][k] += thread->hist[i][j][k];
+            }
+        }
+    }
 
-    sys_dict_release(xdata);
+    pthread_mutex_unlock(&dfc_thread_lock);
 
-    return 0;
+    SYS_FREE(thread);
+}
 
-failed:
-    // Probably there is a serious memory problem. Try to unwind the sort
-    // request and let the client decide. At least we may free some memory
-    // and a future sort request will handle the pending data.
-    SYS_IO(sys_gf_getxattr_unwind_error, (frame, ENOMEM, NULL), NULL);
+// Latency histograms and traces are optional.
+void dfc_thread_initialize(void)
+{
+    err_t error;
 
-    return error;
+    pthread_mutex_lock(&dfc_thread_lock);
+
+    if (!dfc_thread_ready)
+    {
+        error = pthread_key_create(&dfc_thread_key, dfc_thread_destroy);
+        if (error != 0)
+        {
+            logW("Latency histograms and traces are disabled. Error %d",
+                 error);
+        }
+        dfc_thread_ready = (error == 0);
+    }
+
+    pthread_mutex_unlock(&dfc_thread_lock);
 }
 
-SYS_LOCK_CREATE(dfc_sort_client_send, ((dfc_client_t *, client),
-                                       (dfc_sort_t *, sort)))
+dfc_thread_t * dfc_thread_get(void)
 {
-    dfc_request_t * req;
+    dfc_thread_t * thread;
 
-    while (!list_empty(&client->sort_slots))
+    if (!dfc_thread_ready)
     {
-        req = list_entry(client->sort_slots.next, dfc_request_t,
-                         sort_pending_list);
-        list_del_init(&req->sort_pending_list);
+        return NULL;
+    }
 
-        if (sys_delay_cancel((uintptr_t *)req, false))
+    thread = pthread_getspecific(dfc_thread_key);
+    if (thread == NULL)
+    {
+        SYS_MALLOC0(
+            &thread, dfc_mt_dfc_thread_t,
+            E(),
+            RETVAL(NULL)
+        );
+
+        if (pthread_setspecific(dfc_thread_key, thread) != 0)
         {
-            SYS_CALL(
-                dfc_sort_unwind, (req->frame, sort),
-                E(),
-                GOTO(failed)
-            );
+            SYS_FREE(thread);
 
-            if (client->sort == sort)
-            {
-                dfc_sort_initialize(sort);
-            }
-            else
-            {
-                SYS_FREE(sort);
-            }
+            return NULL;
+        }
 
-            SYS_UNLOCK(&client->lock);
+        pthread_mutex_lock(&dfc_thread_lock);
 
-            return;
-        }
+        list_add_tail(&thread->list, &dfc_threads);
+
+        pthread_mutex_unlock(&dfc_thread_lock);
     }
 
-failed:
-    logW("No sort requests available to send info");
+    return thread;
+}
 
-    list_add_tail(&sort->list, &client->sort_pending);
+// Adds an event to the trace of the current thread. 'inode' may be NULL.
+void dfc_trace(dfc_request_t * req, uint32_t type, inode_t * inode)
+{
+    dfc_thread_t * thread;
+    dfc_event_t * event;
+    uint64_t head;
+
+    thread = dfc_thread_get();
+    if (thread == NULL)
+    {
+        return;
+    }
+
+    head = thread->head;
+    event = &thread->trace[head & (DFC_TRACE_SIZE - 1)];
+    event->time = dfc_time();
+    event->txn = req->txn;
+    event->seq = req->seq & INT64_MAX;
+    if (inode != NULL)
+    {
+        uuid_copy(event->gfid, inode->gfid);
+    }
+    else
+    {
+        uuid_clear(event->gfid);
+    }
+    event->client = (req->client != NULL) ? req->client->index : -1;
+    event->brick = ((dfc_manager_t *)req->xl->private)->brick;
+    event->type = type;
+
+    atomic_store(&thread->head, head + 1, memory_order_release);
+}
+
+static int32_t dfc_event_compare(const void * ptr1, const void * ptr2)
+{
+    const dfc_event_t * event1 = ptr1, * event2 = ptr2;
+
+    if (event1->time != event2->time)
+    {
+        return (event1->time < event2->time) ? -1 : 1;
+    }
+
+    return 0;
+}
+
+// Returns the events of this brick from all threads sorted by time. Only the
+// newest 'max' events are kept. The caller must free 'events'.
+err_t dfc_trace_collect(dfc_manager_t * dfc, uint32_t max,
+                        dfc_event_t ** events, uint32_t * count)
+{
+    dfc_thread_t * thread;
+    dfc_event_t * tmp;
+    uint64_t first, last, skip, i;
+    uint32_t size, total, base, threads;
+    err_t error;
+
+    pthread_mutex_lock(&dfc_thread_lock);
+
+    threads = 0;
+    list_for_each_entry(thread, &dfc_threads, list)
+    {
+        threads++;
+    }
+    size = SYS_MAX(threads, 1) * DFC_TRACE_SIZE;
+
+    SYS_CALLOC(
+        &tmp, size, dfc_mt_dfc_event_t,
+        E(),
+        GOTO(failed, &error)
+    );
+
+    total = 0;
+    list_for_each_entry(thread, &dfc_threads, list)
+    {
+        base = total;
+        last = atomic_load(&thread->head, memory_order_acquire);
+        first = (last > DFC_TRACE_SIZE) ? last - DFC_TRACE_SIZE : 0;
+        for (i = first; i < last; i++)
+        {
+            tmp[base + i - first] = thread->trace[i & (DFC_TRACE_SIZE - 1)];
+        }
+        // Entries that the thread may have overwritten while they were
+        // being copied are discarded.
+        skip = atomic_load(&thread->head, memory_order_acquire) + 1;
+        skip = (skip > first + DFC_TRACE_SIZE)
+                   ? skip - first - DFC_TRACE_SIZE : 0;
+        skip = SYS_MIN(skip, last - first);
+        // Only events of this brick are kept.
+        for (i = first + skip; i < last; i++)
+        {
+            if (tmp[base + i - first].brick == dfc->brick)
+            {
+                tmp[total++] = tmp[base + i - first];
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&dfc_thread_lock);
+
+    qsort(tmp, total, sizeof(dfc_event_t), dfc_event_compare);
+    if (total > max)
+    {
+        memmove(tmp, &tmp[total - max], max * sizeof(dfc_event_t));
+        total = max;
+    }
+
+    *events = tmp;
+    *count = total;
+
+    return 0;
+
+failed:
+    pthread_mutex_unlock(&dfc_thread_lock);
+
+    return error;
+}
+
+static inline void dfc_latency_update(uint64_t * hist, uint64_t start,
+                                      uint64_t end)
+{
+    uint64_t delta;
+
+    delta = (end > start) ? end - start : 0;
+    if (delta == 0)
+    {
+        hist[0]++;
+    }
+    else
+    {
+        hist[SYS_MIN(64 - __builtin_clzll(delta),
+                     DFC_LATENCY_BUCKETS - 1)]++;
+    }
+}
+
+// Subtransactions are not sorted by themselves. They use the times of their
+// root.
+void dfc_latency_record(dfc_request_t * req)
+{
+    dfc_thread_t * thread;
+    uint64_t (* hist)[DFC_LATENCY_BUCKETS];
+    uint64_t sorted, ready, now;
+
+    if ((req->fop < 0) || (req->fop >= GF_FOP_MAXVALUE))
+    {
+        return;
+    }
+
+    thread = dfc_thread_get();
+    if (thread == NULL)
+    {
+        return;
+    }
+
+    now = dfc_time();
+
+    sorted = req->time_sorted;
+    ready = req->time_ready;
+    if (sorted == 0)
+    {
+        sorted = req->root->time_sorted;
+        ready = req->root->time_ready;
+    }
+    if ((sorted == 0) || (sorted < req->time_arrival))
+    {
+        sorted = req->time_arrival;
+    }
+    if ((ready == 0) || (ready < sorted))
+    {
+        ready = sorted;
+    }
+
+    hist = thread->hist[req->fop];
+    dfc_latency_update(hist[DFC_LATENCY_SORT], req->time_arrival, sorted);
+    dfc_latency_update(hist[DFC_LATENCY_DEPS], sorted, ready);
+    dfc_latency_update(hist[DFC_LATENCY_EXEC], req->time_wind, now);
+}
+
+// Adds the histograms of one fop from all threads. They include all bricks
+// of the process. Counters are read while they are being updated, so the
+// result can be slightly inconsistent.
+void dfc_latency_collect(int32_t fop,
+                         uint64_t hist[DFC_LATENCY_COUNT][DFC_LATENCY_BUCKETS])
+{
+    dfc_thread_t * thread;
+    int32_t i, j;
+
+    pthread_mutex_lock(&dfc_thread_lock);
+
+    for (i = 0; i < DFC_LATENCY_COUNT; i++)
+    {
+        for (j = 0; j < DFC_LATENCY_BUCKETS; j++)
+        {
+            hist[i][j] = dfc_thread_retired[fop][i][j];
+        }
+    }
+    list_for_each_entry(thread, &dfc_threads, list)
+    {
+        for (i = 0; i < DFC_LATENCY_COUNT; i++)
+        {
+            for (j = 0; j < DFC_LATENCY_BUCKETS; j++)
+            {
+                hist[i][j] += thread->hist[fop][i][j];
+            }
+        }
+    }
+
+    pthread_mutex_unlock(&dfc_thread_lock);
+}
+
+err_t dfc_segment_get(dfc_manager_t * dfc, size_t size,
+                      dfc_segment_t ** segment)
+{
+    dfc_segment_t * tmp;
+
+    tmp = NULL;
+    if (size <= DFC_SEGMENT_SIZE)
+    {
+        size = DFC_SEGMENT_SIZE;
+
+        LOCK(&dfc->segment_lock);
+
+        if (!list_empty(&dfc->segments))
+        {
+            tmp = list_entry(dfc->segments.next, dfc_segment_t, list);
+            list_del_init(&tmp->list);
+            dfc->segment_count--;
+        }
+
+        UNLOCK(&dfc->segment_lock);
+    }
+
+    if (tmp == NULL)
+    {
+        SYS_ALLOC(
+            &tmp, sizeof(dfc_segment_t) + size, dfc_mt_dfc_segment_t,
+            E(),
+            RETERR()
+        );
+
+        INIT_LIST_HEAD(&tmp->list);
+        tmp->length = size;
+    }
+
+    tmp->head = tmp->data;
+    tmp->size = tmp->length;
+
+    *segment = tmp;
+
+    return 0;
+}
+
+void dfc_segment_put(dfc_manager_t * dfc, dfc_segment_t * segment)
+{
+    if (segment->length == DFC_SEGMENT_SIZE)
+    {
+        LOCK(&dfc->segment_lock);
+
+        if (dfc->segment_count < DFC_SEGMENT_POOL)
+        {
+            list_add(&segment->list, &dfc->segments);
+            dfc->segment_count++;
+            segment = NULL;
+        }
+
+        UNLOCK(&dfc->segment_lock);
+    }
+
+    if (segment != NULL)
+    {
+        SYS_FREE(segment);
+    }
+}
+
+void dfc_sort_initialize(dfc_sort_t * sort)
+{
+    INIT_LIST_HEAD(&sort->segments);
+    sort->length = 0;
+    sort->count = 0;
+    sort->pending = true;
+}
+
+void dfc_sort_release(dfc_manager_t * dfc, dfc_sort_t * sort)
+{
+    dfc_segment_t * segment;
+
+    while (!list_empty(&sort->segments))
+    {
+        segment = list_entry(sort->segments.next, dfc_segment_t, list);
+        list_del_init(&segment->list);
+
+        dfc_segment_put(dfc, segment);
+    }
+
+    dfc_sort_initialize(sort);
+}
+
+err_t dfc_sort_add_block(dfc_manager_t * dfc, dfc_sort_t * sort, void * data,
+                         size_t size)
+{
+    dfc_segment_t * segment;
+    size_t length;
+
+    if (!list_empty(&sort->segments))
+    {
+        segment = list_entry(sort->segments.prev, dfc_segment_t, list);
+        length = segment->size;
+        if (SYS_CALL(
+                sys_buf_set_block, (&segment->head, &segment->size, data,
+                                    size),
+                D()
+            ) == 0)
+        {
+            sort->length += length - segment->size;
+            sort->count++;
+
+            return 0;
+        }
+    }
+
+    SYS_CALL(
+        dfc_segment_get, (dfc, size + DFC_BLOCK_OVERHEAD, &segment),
+        E(),
+        RETERR()
+    );
+    list_add_tail(&segment->list, &sort->segments);
+
+    length = segment->size;
+    SYS_CALL(
+        sys_buf_set_block, (&segment->head, &segment->size, data, size),
+        E(),
+        ASSERT("Internal buffer too small.")
+    );
+    sort->length += length - segment->size;
+    sort->count++;
+
+    return 0;
+}
+
+void dfc_sort_flatten(dfc_sort_t * sort, void * buffer)
+{
+    dfc_segment_t * segment;
+    size_t size;
+
+    list_for_each_entry(segment, &sort->segments, list)
+    {
+        size = segment->head - (void *)segment->data;
+        memcpy(buffer, segment->data, size);
+        buffer += size;
+    }
+}
+
+err_t dfc_sort_create(dfc_client_t * client)
+{
+    SYS_MALLOC(
+        &client->sort, dfc_mt_dfc_sort_t,
+        E(),
+        RETERR()
+    );
+
+    INIT_LIST_HEAD(&client->sort->list);
+    client->sort->dfc = client->dfc;
+    dfc_sort_initialize(client->sort);
+
+    return 0;
+}
+
+// Adapt the batching window to the arrival rate of dependency blocks. If
+// they arrive closer than the maximum window, a delayed send will very
+// likely carry more than one of them, so the window is widened. Otherwise it
+// is progressively closed.
+void dfc_sort_adapt(dfc_client_t * client)
+{
+    dfc_batching_t * batching;
+    uint64_t now;
+
+    now = dfc_time();
+    batching = &client->dfc->batching;
+    if (batching->adaptive)
+    {
+        if ((client->batch_last != 0) &&
+            (now - client->batch_last < batching->delay * 1000ULL))
+        {
+            client->batch_window = SYS_MIN(SYS_MAX(client->batch_window * 2,
+                                                   1),
+                                           batching->delay);
+        }
+        else
+        {
+            client->batch_window /= 2;
+        }
+    }
+    client->batch_last = now;
+}
+
+void dfc_sort_done(dfc_client_t * client, dfc_sort_t * sort)
+{
+    dfc_sort_release(client->dfc, sort);
+    if (client->sort != sort)
+    {
+        SYS_FREE(sort);
+    }
+}
+
+// Frees a sort that is not referenced by its client anymore.
+void dfc_sort_free(dfc_sort_t * sort)
+{
+    dfc_sort_release(sort->dfc, sort);
+    SYS_FREE(sort);
+}
+
+// Moves pending sorts into 'list' while the size of the reply does not
+// exceed DFC_SORT_MAX. At least one sort is always taken.
+void dfc_sort_collect(struct list_head * pending, struct list_head * list,
+                      size_t length)
+{
+    dfc_sort_t * sort;
+
+    while (!list_empty(pending))
+    {
+        sort = list_entry(pending->next, dfc_sort_t, list);
+        if (!list_empty(list) && (length + sort->length > DFC_SORT_MAX))
+        {
+            break;
+        }
+        list_move_tail(&sort->list, list);
+        length += sort->length;
+    }
+}
+
+void dfc_sort_done_list(dfc_client_t * client, struct list_head * list)
+{
+    dfc_sort_t * sort;
+
+    while (!list_empty(list))
+    {
+        sort = list_entry(list->next, dfc_sort_t, list);
+        list_del_init(&sort->list);
+
+        dfc_sort_done(client, sort);
+    }
+}
+
+void dfc_sort_free_list(struct list_head * list)
+{
+    dfc_sort_t * sort;
+
+    while (!list_empty(list))
+    {
+        sort = list_entry(list->next, dfc_sort_t, list);
+        list_del_init(&sort->list);
+
+        dfc_sort_free(sort);
+    }
+}
+
+// Concatenates all sorts from 'list' that belong to 'dfc' (or all of them if
+// it is NULL) into a single xattr.
+err_t dfc_sort_set(dict_t * xdata, const char * key, struct list_head * list,
+                   dfc_manager_t * dfc)
+{
+    dfc_sort_t * sort;
+    void * data, * ptr;
+    size_t length;
+
+    length = 0;
+    list_for_each_entry(sort, list, list)
+    {
+        if ((dfc == NULL) || (sort->dfc == dfc))
+        {
+            length += sort->length;
+        }
+    }
+
+    // The flattened sort data is owned by the dict, so it is only copied
+    // once.
+    SYS_PTR(
+        &data, GF_MALLOC, (SYS_MAX(length, 1), gf_common_mt_char),
+        ENOMEM,
+        E(),
+        RETERR()
+    );
+    ptr = data;
+    list_for_each_entry(sort, list, list)
+    {
+        if ((dfc == NULL) || (sort->dfc == dfc))
+        {
+            dfc_sort_flatten(sort, ptr);
+            ptr += sort->length;
+        }
+    }
+
+    if (dict_set_dynptr(xdata, (char *)key, data, length) != 0)
+    {
+        GF_FREE(data);
+
+        return ENOMEM;
+    }
+
+    list_for_each_entry(sort, list, list)
+    {
+        if ((dfc == NULL) || (sort->dfc == dfc))
+        {
+            atomic_add(&sort->dfc->stats.sort_out, sort->length,
+                       memory_order_relaxed);
+        }
+    }
+
+    return 0;
+}
+
+// Sort requests that had to wait for data are marked, so that the client
+// does not take the waiting time as network latency.
+void dfc_sort_mark_parked(dict_t ** xdata, bool parked)
+{
+    uint8_t empty;
+
+    if (parked)
+    {
+        SYS_CALL(
+            sys_dict_set_bin, (xdata, DFC_XATTR_PARKED, &empty, 0, NULL),
+            E()
+        );
+    }
+}
+
+err_t dfc_sort_unwind(call_frame_t * frame, const char * key,
+                      struct list_head * list, bool parked)
+{
+    dict_t * xdata;
+    err_t error = 0;
+
+    SYS_PTR(
+        &xdata, dict_new, (),
+        ENOMEM,
+        E(),
+        GOTO(failed, &error)
+    );
+
+    SYS_CALL(
+        dfc_sort_set, (xdata, key, list, NULL),
+        E(),
+        GOTO(failed_dict, &error)
+    );
+    dfc_sort_mark_parked(&xdata, parked);
+
+    SYS_IO(sys_gf_getxattr_unwind, (frame, 0, 0, xdata, NULL), NULL);
+
+    dict_unref(xdata);
+
+    return 0;
+
+failed_dict:
+    dict_unref(xdata);
+failed:
+    // Probably there is a serious memory problem. Try to unwind the sort
+    // request and let the client decide. At least we may free some memory
+    // and a future sort request will handle the pending data.
+    SYS_IO(sys_gf_getxattr_unwind_error, (frame, ENOMEM, NULL), NULL);
+
+    return error;
+}
+
+err_t dfc_channel_unwind(call_frame_t * frame, struct list_head * list,
+                         bool parked)
+{
+    dict_t * xdata;
+    dfc_sort_t * sort, * tmp;
+    char key[64];
+    err_t error = 0;
+
+    SYS_PTR(
+        &xdata, dict_new, (),
+        ENOMEM,
+        E(),
+        GOTO(failed, &error)
+    );
+
+    // Each brick uses its own key so that the client can demultiplex the
+    // data. All sorts of the same brick are stored together.
+    list_for_each_entry(sort, list, list)
+    {
+        list_for_each_entry(tmp, list, list)
+        {
+            if ((tmp == sort) || (tmp->dfc == sort->dfc))
+            {
+                break;
+            }
+        }
+        if (tmp == sort)
+        {
+            snprintf(key, sizeof(key), "%s.%u", DFC_XATTR_SORT,
+                     sort->dfc->brick);
+            SYS_CALL(
+                dfc_sort_set, (xdata, key, list, sort->dfc),
+                E(),
+                GOTO(failed_dict, &error)
+            );
+        }
+    }
+    dfc_sort_mark_parked(&xdata, parked);
+
+    SYS_IO(sys_gf_getxattr_unwind, (frame, 0, 0, xdata, NULL), NULL);
+
+    dict_unref(xdata);
+
+    return 0;
+
+failed_dict:
+    dict_unref(xdata);
+failed:
+    SYS_IO(sys_gf_getxattr_unwind_error, (frame, ENOMEM, NULL), NULL);
+
+    return error;
+}
+
+SYS_LOCK_CREATE(dfc_channel_send, ((dfc_channel_t *, channel),
+                                   (dfc_sort_t *, sort)))
+{
+    struct list_head list;
+    dfc_slot_t * slot;
+
+    INIT_LIST_HEAD(&list);
+    list_add_tail(&sort->list, &list);
+    dfc_sort_collect(&channel->pending, &list, sort->length);
+
+    while (!list_empty(&channel->slots))
+    {
+        slot = list_entry(channel->slots.next, dfc_slot_t, list);
+        list_del_init(&slot->list);
+        channel->parked--;
+
+        if (sys_delay_cancel((uintptr_t *)slot, false))
+        {
+            SYS_CALL(
+                dfc_channel_unwind, (slot->frame, &list, true),
+                E(),
+                GOTO(failed)
+            );
+
+            dfc_sort_free_list(&list);
+
+            SYS_UNLOCK(&channel->lock);
+
+            return;
+        }
+    }
+
+failed:
+    list_del_init(&sort->list);
+    list_splice(&list, &channel->pending);
+    list_add_tail(&sort->list, &channel->pending);
+
+    SYS_UNLOCK(&channel->lock);
+}
+
+SYS_LOCK_CREATE(__dfc_channel_retry, ((dfc_slot_t *, slot)))
+{
+    if (!list_empty(&slot->list))
+    {
+        list_del_init(&slot->list);
+        slot->channel->parked--;
+
+        SYS_UNLOCK(&slot->channel->lock);
+
+        sys_delay_release((uintptr_t *)slot);
+    }
+    else
+    {
+        SYS_UNLOCK(&slot->channel->lock);
+    }
+}
+
+SYS_DELAY_CREATE(dfc_channel_retry, ((void, data, CALLS)))
+{
+    dfc_slot_t * slot;
+
+    slot = (dfc_slot_t *)(data - DFC_SLOT_SIZE);
+    SYS_LOCK(&slot->channel->lock, __dfc_channel_retry, (slot));
+
+    SYS_IO(sys_gf_getxattr_unwind, (slot->frame, 0, 0, NULL, NULL), NULL);
+}
+
+SYS_LOCK_CREATE(dfc_channel_recv, ((dfc_channel_t *, channel),
+                                   (call_frame_t *, frame)))
+{
+    struct list_head list;
+    dfc_slot_t * slot;
+
+    channel->last = time(NULL);
+    if (!list_empty(&channel->pending))
+    {
+        INIT_LIST_HEAD(&list);
+        dfc_sort_collect(&channel->pending, &list, 0);
+
+        dfc_channel_unwind(frame, &list, false);
+
+        dfc_sort_free_list(&list);
+    }
+    else
+    {
+        slot = (dfc_slot_t *)__SYS_DELAY(30000, DFC_SLOT_SIZE,
+                                         dfc_channel_retry, (NULL), 1);
+        slot->channel = channel;
+        slot->frame = frame;
+        list_add_tail(&slot->list, &channel->slots);
+        channel->parked++;
+    }
+
+    SYS_UNLOCK(&channel->lock);
+}
+
+// Moves a sort to the shared channel of the process. From now on it is not
+// owned by the client.
+void dfc_sort_client_forward(dfc_client_t * client, dfc_sort_t * sort)
+{
+    if (client->sort == sort)
+    {
+        client->sort = NULL;
+    }
+    SYS_LOCK(&client->channel->lock, dfc_channel_send, (client->channel, sort));
+}
+
+// From now on, sort data of the client is sent through the shared channel,
+// including the backlog kept by this brick. Only the brick that receives the
+// polls of the channel would otherwise send it.
+void __dfc_client_bind(dfc_client_t * client, dfc_channel_t * channel)
+{
+    dfc_sort_t * sort;
+
+    client->channel = channel;
+    while ((channel != NULL) && !list_empty(&client->sort_pending))
+    {
+        sort = list_entry(client->sort_pending.next, dfc_sort_t, list);
+        list_del_init(&sort->list);
+
+        dfc_sort_client_forward(client, sort);
+    }
+}
+
+void __dfc_sort_client_send(dfc_client_t * client, dfc_sort_t * sort)
+{
+    struct list_head list;
+    dfc_request_t * req;
+
+    if (client->channel != NULL)
+    {
+        dfc_sort_client_forward(client, sort);
+
+        return;
+    }
+
+    // Any backlog is sent along with the new data.
+    INIT_LIST_HEAD(&list);
+    list_add_tail(&sort->list, &list);
+    dfc_sort_collect(&client->sort_pending, &list, sort->length);
+
+    while (!list_empty(&client->sort_slots))
+    {
+        req = list_entry(client->sort_slots.next, dfc_request_t,
+                         sort_pending_list);
+        list_del_init(&req->sort_pending_list);
+        client->slots--;
+
+        if (sys_delay_cancel((uintptr_t *)req, false))
+        {
+            SYS_CALL(
+                dfc_sort_unwind, (req->frame, DFC_XATTR_SORT, &list, true),
+                E(),
+                GOTO(failed)
+            );
+
+            dfc_sort_done_list(client, &list);
+
+            return;
+        }
+    }
+
+failed:
+    logW("No sort requests available to send info");
+
+    list_del_init(&sort->list);
+    list_splice(&list, &client->sort_pending);
+    list_add_tail(&sort->list, &client->sort_pending);
+}
+
+dfc_sort_t * dfc_sort_client_take(dfc_client_t * client)
+{
+    dfc_sort_t * sort;
+
+    sort = client->ready;
+    while ((sort != NULL) &&
+           !atomic_cmpxchg(&client->ready, sort, NULL, memory_order_seq_cst,
+                           memory_order_seq_cst))
+    {
+        sort = client->ready;
+    }
+
+    return sort;
+}
+
+SYS_LOCK_CREATE(dfc_sort_client_fallback, ((dfc_client_t *, client)))
+{
+    dfc_sort_t * sort;
+
+    // No fop reply has taken the sort data. Use a sort request.
+    sort = dfc_sort_client_take(client);
+    if (sort != NULL)
+    {
+        __dfc_sort_client_send(client, sort);
+    }
+
+    SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
+
+SYS_DELAY_CREATE(dfc_sort_client_piggyback_timeout, ((dfc_client_t *, client)))
+{
+    SYS_LOCK(&client->lock, dfc_sort_client_fallback, (client));
+}
+
+SYS_LOCK_CREATE(dfc_sort_client_requeue, ((dfc_client_t *, client),
+                                          (dfc_sort_t *, sort)))
+{
+    __dfc_sort_client_send(client, sort);
+
+    SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
+
+SYS_LOCK_CREATE(dfc_sort_client_send, ((dfc_client_t *, client),
+                                       (dfc_sort_t *, sort)))
+{
+    // While there are requests being executed, sort data is attached to
+    // the first reply instead of consuming a sort request, but only if the
+    // client looks for it there.
+    if (((client->features & DFC_FEATURE_PIGGYBACK) != 0) &&
+        (client->executing > 0) && (client->ready == NULL) &&
+        list_empty(&client->sort_pending))
+    {
+        if (client->sort == sort)
+        {
+            client->sort = NULL;
+        }
+        client->ready = sort;
+
+        atomic_inc(&client->refs, memory_order_seq_cst);
+        SYS_DELAY(DFC_PIGGYBACK_DELAY, dfc_sort_client_piggyback_timeout,
+                  (client));
+    }
+    else
+    {
+        __dfc_sort_client_send(client, sort);
+    }
+
+    SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
+
+// Attach pending sort data, if any, to the reply of a fop.
+void dfc_sort_piggyback(dfc_request_t * req, dict_t ** xdata)
+{
+    struct list_head list;
+    dfc_client_t * client;
+    dfc_sort_t * sort;
+
+    client = req->client;
+    if ((client == NULL) || (client->ready == NULL))
+    {
+        return;
+    }
+
+    sort = dfc_sort_client_take(client);
+    if (sort == NULL)
+    {
+        return;
+    }
+
+    if (*xdata == NULL)
+    {
+        SYS_PTR(
+            xdata, dict_new, (),
+            ENOMEM,
+            E(),
+            GOTO(failed)
+        );
+    }
+    INIT_LIST_HEAD(&list);
+    list_add_tail(&sort->list, &list);
+    SYS_CALL(
+        dfc_sort_set, (*xdata, DFC_XATTR_SORT, &list, NULL),
+        E(),
+        GOTO(failed_list)
+    );
+
+    dfc_sort_free_list(&list);
+
+    return;
+
+failed_list:
+    list_del_init(&sort->list);
+failed:
+    atomic_inc(&client->refs, memory_order_seq_cst);
+    SYS_LOCK(&client->lock, dfc_sort_client_requeue, (client, sort));
+}
+
+SYS_LOCK_CREATE(__dfc_sort_client_retry, ((dfc_request_t *, req)))
+{
+    if (!list_empty(&req->sort_pending_list))
+    {
+        list_del_init(&req->sort_pending_list);
+        req->client->slots--;
+
+        SYS_UNLOCK(&req->client->lock);
+
+        sys_delay_release((uintptr_t *)req);
+    }
+    else
+    {
+        SYS_UNLOCK(&req->client->lock);
+    }
+}
+
+SYS_DELAY_CREATE(dfc_sort_client_retry, ((void, data, CALLS)))
+{
+    dfc_request_t * req;
+
+    req = (dfc_request_t *)(data - DFC_REQ_SIZE);
+    SYS_LOCK(&req->client->lock, __dfc_sort_client_retry, (req));
+
+    SYS_IO(sys_gf_getxattr_unwind, (req->frame, 0, 0, NULL, NULL), NULL);
+}
+
+void __dfc_sort_client_flush(dfc_client_t * client, dfc_sort_t * sort)
+{
+    sort->pending = false;
+    client->batch_armed = false;
+    client->batch_gen++;
+    atomic_inc(&client->refs, memory_order_seq_cst);
+    SYS_LOCK(&client->lock, dfc_sort_client_send, (client, sort));
+}
+
+SYS_LOCK_CREATE(dfc_sort_client_flush, ((dfc_client_t *, client),
+                                        (uint32_t, gen)))
+{
+    dfc_sort_t * sort;
+
+    // The sort may have already been sent because a threshold was reached.
+    sort = client->sort;
+    if (client->batch_armed && (client->batch_gen == gen) && (sort != NULL) &&
+        sort->pending && (sort->count > 0))
+    {
+        __dfc_sort_client_flush(client, sort);
+    }
+
+    SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
 
-    SYS_UNLOCK(&client->lock);
+SYS_DELAY_CREATE(dfc_sort_client_window, ((dfc_client_t *, client),
+                                          (uint32_t, gen)))
+{
+    SYS_LOCK(&client->lock, dfc_sort_client_flush, (client, gen));
 }
 
-SYS_LOCK_CREATE(__dfc_sort_client_retry, ((dfc_request_t *, req)))
+void dfc_sort_client_batch(dfc_client_t * client, dfc_sort_t * sort)
 {
-    if (!list_empty(&req->sort_pending_list))
-    {
-        list_del_init(&req->sort_pending_list);
+    dfc_batching_t * batching;
+    uint32_t delay;
 
-        SYS_UNLOCK(&req->client->lock);
+    batching = &client->dfc->batching;
+    delay = batching->delay;
+    if (batching->adaptive)
+    {
+        delay = client->batch_window;
+    }
 
-        sys_delay_release((uintptr_t *)req);
+    if ((delay == 0) || (sort->length >= batching->bytes) ||
+        (sort->count >= batching->count))
+    {
+        __dfc_sort_client_flush(client, sort);
     }
-    else
+    else if (!client->batch_armed)
     {
-        SYS_UNLOCK(&req->client->lock);
+        // Allow other requests to be accumulated. The timer keeps a
+        // reference to the client.
+        client->batch_armed = true;
+        atomic_inc(&client->refs, memory_order_seq_cst);
+        SYS_DELAY(delay, dfc_sort_client_window, (client, client->batch_gen));
     }
 }
 
-SYS_DELAY_CREATE(dfc_sort_client_retry, ((void, data, CALLS)))
-{
-    dfc_request_t * req;
-
-    req = (dfc_request_t *)(data - DFC_REQ_SIZE);
-    SYS_LOCK(&req->client->lock, __dfc_sort_client_retry, (req));
-
-    SYS_IO(sys_gf_getxattr_unwind, (req->frame, 0, 0, NULL, NULL), NULL);
-}
-
 void dfc_dependency_initialize(dfc_dependencies_t * deps, int64_t txn)
 {
+    deps->data = deps->storage;
+    deps->length = sizeof(deps->storage);
     deps->head = deps->data;
-    deps->size = sizeof(deps->data);
+    deps->size = deps->length;
     SYS_CALL(
         sys_buf_check, (&deps->size, sizeof(int64_t)),
         E(),
@@ -403,16 +1870,63 @@ void dfc_dependency_initialize(dfc_dependencies_t * deps, int64_t txn)
     deps->buffer = deps->head;
 }
 
+void dfc_dependency_release(dfc_dependencies_t * deps)
+{
+    if (deps->data != deps->storage)
+    {
+        SYS_FREE(deps->data);
+    }
+}
+
+err_t dfc_dependency_check(dfc_dependencies_t * deps, size_t size)
+{
+    uint8_t * data;
+    size_t used, length;
+
+    if (deps->size < size)
+    {
+        used = deps->head - (void *)deps->data;
+        length = SYS_MAX(deps->length * 2, used + size);
+        SYS_ALLOC(
+            &data, length, sys_mt_uint8_t,
+            E(),
+            RETERR()
+        );
+        memcpy(data, deps->data, used);
+
+        deps->buffer = data + (deps->buffer - (void *)deps->data);
+        deps->head = data + used;
+        deps->size = length - used;
+        deps->length = length;
+
+        dfc_dependency_release(deps);
+        deps->data = data;
+    }
+
+    return SYS_CALL(
+               sys_buf_check, (&deps->size, size),
+               E(),
+               ASSERT("Internal buffer too small.")
+           );
+}
+
 err_t dfc_dependency_copy(dfc_dependencies_t * deps, void * data)
 {
-    return sys_buf_set_raw(&deps->head, &deps->size, data,
-                           sizeof(uuid_t) + sizeof(int64_t));
+    SYS_CALL(
+        dfc_dependency_check, (deps, sizeof(uuid_t) + sizeof(int64_t)),
+        E(),
+        RETERR()
+    );
+    memcpy(deps->head, data, sizeof(uuid_t) + sizeof(int64_t));
+    deps->head += sizeof(uuid_t) + sizeof(int64_t);
+
+    return 0;
 }
 
 err_t dfc_dependency_add(dfc_dependencies_t * deps, uuid_t uuid, int64_t txn)
 {
     SYS_CALL(
-        sys_buf_check, (&deps->size, sizeof(uuid_t) + sizeof(int64_t)),
+        dfc_dependency_check, (deps, sizeof(uuid_t) + sizeof(int64_t)),
         E(),
         RETERR()
     );
@@ -489,6 +2003,8 @@ err_t dfc_link_add(xlator_t * xl, dfc_link_t * link, dfc_dependencies_t * deps)
             E(),
             GOTO(done, &error)
         );
+        atomic_inc(&((dfc_manager_t *)xl->private)->stats.inodes,
+                   memory_order_relaxed);
     }
     else
     {
@@ -550,6 +2066,8 @@ err_t dfc_link_add(xlator_t * xl, dfc_link_t * link, dfc_dependencies_t * deps)
         {
             list_add_tail(&link->inode_list, &first->inode_list);
         }
+
+        dfc_trace(link->request, DFC_EVENT_DEPEND, inode);
     }
 
 done:
@@ -752,6 +2270,9 @@ dfc_request_t * dfc_link_allowed(dfc_link_t * link, dfc_link_t * root)
         req->sort_size = new_size;
         if (new_size == 0)
         {
+            DFC_PROBE(link_allowed, req->client->index, req->txn,
+                      req->seq & INT64_MAX, DFC_GFID(link->inode), 1);
+
             return req;
         }
 
@@ -760,6 +2281,9 @@ dfc_request_t * dfc_link_allowed(dfc_link_t * link, dfc_link_t * root)
         dfc_link_scan(root, link, graph, &index, &cycle);
         if (list_empty(&cycle))
         {
+            DFC_PROBE(link_allowed, req->client->index, req->txn,
+                      req->seq & INT64_MAX, DFC_GFID(link->inode), 0);
+
             return NULL;
         }
 
@@ -778,6 +2302,8 @@ dfc_request_t * dfc_link_allowed(dfc_link_t * link, dfc_link_t * root)
         }
 
         dfc_link_break(tmp, &cycle);
+        atomic_inc(&req->client->dfc->stats.cycles, memory_order_relaxed);
+        dfc_trace(tmp->request, DFC_EVENT_CYCLE, tmp->inode);
 
         while (!list_empty(&cycle))
         {
@@ -796,6 +2322,8 @@ dfc_request_t * dfc_link_check(dfc_link_t * link, dfc_link_t * root)
         if ((req != NULL) &&
             (atomic_dec(&req->refs, memory_order_seq_cst) == 1))
         {
+            req->time_ready = dfc_time();
+
             return req;
         }
     }
@@ -857,6 +2385,8 @@ void dfc_link_del(xlator_t * xl, dfc_link_t * link)
         if (list_empty(&link->inode_list))
         {
             value = 0;
+            atomic_dec(&((dfc_manager_t *)xl->private)->stats.inodes,
+                       memory_order_relaxed);
         }
         else
         {
@@ -920,6 +2450,12 @@ void dfc_request_free(dfc_request_t * req)
     sys_fd_release(req->fd);
     sys_loc_release(&req->loc);
 
+    // Reference taken when the request was admitted.
+    if (req->client != NULL)
+    {
+        dfc_client_put(req->client);
+    }
+
     sys_gf_args_free((uintptr_t *)req);
 }
 
@@ -931,6 +2467,8 @@ SYS_LOCK_CREATE(__dfc_request_complete, ((dfc_request_t *, req)))
     req->completed = true;
     root = req->root;
     client = root->client;
+    DFC_PROBE(request_complete, client->index, req->txn, req->seq & INT64_MAX,
+              DFC_GFID(root->link1.inode));
     if (req != root)
     {
         list_del_init(&req->sibling_list);
@@ -939,17 +2477,26 @@ SYS_LOCK_CREATE(__dfc_request_complete, ((dfc_request_t *, req)))
     {
         if ((root->seq & INT64_MIN) == 0)
         {
-            client->next_txn += 256;
+            client->next_txn += 1LL << DFC_TXN_SHIFT;
             if (root->sequence_list.next != &client->sequence)
             {
                 next = list_entry(root->sequence_list.next, dfc_request_t,
                                   sequence_list);
-                if ((root->seq & INT64_MAX) + 1 == (next->seq & INT64_MAX))
+                // Requests between both that were lost before a resume
+                // will never arrive.
+                if (((root->seq & INT64_MAX) + 1 == (next->seq & INT64_MAX)) ||
+                    ((next->seq & INT64_MAX) <= client->resume_seq + 1))
                 {
                     client->next_txn = next->txn;
                 }
             }
             list_del_init(&root->sequence_list);
+            if (list_empty(&client->sequence) &&
+                (client->next_txn <= client->resume_txn))
+            {
+                client->next_txn = client->resume_txn +
+                                   (1LL << DFC_TXN_SHIFT);
+            }
 
             if (root->link1.inode != NULL)
             {
@@ -1002,6 +2549,9 @@ SYS_CBK_CREATE(dfc_request_complete, data, ((dfc_request_t *, req)))
 
     if (req->client != NULL)
     {
+        dfc_latency_record(req);
+        dfc_trace(req, DFC_EVENT_COMPLETE, NULL);
+        atomic_dec(&req->client->executing, memory_order_seq_cst);
         SYS_LOCK(&req->client->lock, __dfc_request_complete, (req));
     }
     else
@@ -1112,7 +2662,15 @@ void dfc_request_execute(dfc_request_t * req)
             req->started = true;
             if (!bad && !req->fake)
             {
+                if (req->client != NULL)
+                {
+                    atomic_inc(&req->client->executing, memory_order_seq_cst);
+                }
                 dfc_size_save(req);
+                dfc_trace(req, DFC_EVENT_EXECUTE, NULL);
+                DFC_PROBE(execute, req->txn, req->seq & INT64_MAX,
+                          DFC_GFID(req->link1.inode), req->fop);
+                req->time_wind = dfc_time();
                 sys_gf_wind(req->frame, NULL, FIRST_CHILD(req->xl),
                             SYS_CBK(dfc_request_complete, (req)),
                             NULL, (uintptr_t *)req,
@@ -1122,6 +2680,9 @@ void dfc_request_execute(dfc_request_t * req)
             {
                 if (!req->fake)
                 {
+                    atomic_inc(&((dfc_manager_t *)req->xl->private)->stats.bad,
+                               memory_order_relaxed);
+                    dfc_trace(req, DFC_EVENT_BAD, NULL);
                     sys_gf_unwind_error(req->frame, EUCLEAN, NULL, NULL, NULL,
                                         (uintptr_t *)req,
                                         (uintptr_t *)req + DFC_REQ_SIZE);
@@ -1165,12 +2726,21 @@ err_t dfc_request_dependencies(dfc_request_t * req, dfc_dependencies_t * deps)
             E(),
             GOTO(failed, &error)
         );
-        dfc_dependency_merge(deps, &deps_aux);
+        error = dfc_dependency_merge(deps, &deps_aux);
+        dfc_dependency_release(&deps_aux);
+        if (error != 0)
+        {
+            dfc_link_del(req->xl, &req->link2);
+
+            goto failed_link;
+        }
     }
 
     return 0;
 
 failed:
+    dfc_dependency_release(&deps_aux);
+failed_link:
     dfc_link_del(req->xl, &req->link1);
 
     return error;
@@ -1192,6 +2762,7 @@ err_t dfc_request_prepare(dfc_manager_t * dfc, dfc_request_t * req,
     dfc_dependencies_t deps;
     dfc_client_t * client;
     void * tmp, * top;
+    err_t error;
 
     dfc_dependency_initialize(&deps, 0);
 
@@ -1203,7 +2774,7 @@ err_t dfc_request_prepare(dfc_manager_t * dfc, dfc_request_t * req,
             dfc_client_get, (dfc, *__sys_buf_ptr_uuid(&data), &client),
             E(),
             LOG(E(), "Unknown referenced client"),
-            RETERR()
+            GOTO(failed, &error)
         );
 
         if (__sys_buf_get_int64(&data) >= client->next_txn)
@@ -1212,9 +2783,11 @@ err_t dfc_request_prepare(dfc_manager_t * dfc, dfc_request_t * req,
                 dfc_dependency_copy, (&deps, tmp),
                 E(),
                 LOG(E(), "Unable to copy dependencies"),
-                RETERR()
+                GOTO(failed_client, &error)
             );
         }
+
+        dfc_client_put(client);
     }
 
     size = deps.head - deps.buffer;
@@ -1223,23 +2796,58 @@ err_t dfc_request_prepare(dfc_manager_t * dfc, dfc_request_t * req,
         SYS_ALLOC(
             &req->sort, size, sys_mt_uint8_t,
             E(),
-            RETERR()
+            GOTO(failed, &error)
         );
         memcpy(req->sort, deps.buffer, size);
     }
 
     req->sort_size = size;
 
+    dfc_dependency_release(&deps);
+
     return 0;
+
+failed_client:
+    dfc_client_put(client);
+failed:
+    dfc_dependency_release(&deps);
+
+    return error;
 }
 
 void dfc_sort_client_process(dfc_request_t * req);
 
+// Requests sent before a resume and not received yet have been lost with
+// the previous connection. Skip them up to the first one present.
+void __dfc_client_skip(dfc_client_t * client)
+{
+    dfc_request_t * req;
+    int64_t seq;
+
+    if (client->next_receive > client->resume_seq)
+    {
+        return;
+    }
+
+    seq = client->resume_seq + 1;
+    list_for_each_entry(req, &client->sequence, sequence_list)
+    {
+        if ((req->seq & INT64_MAX) >= client->next_receive)
+        {
+            seq = SYS_MIN(seq, req->seq & INT64_MAX);
+
+            break;
+        }
+    }
+    client->next_receive = seq;
+}
+
 void __dfc_serialize(dfc_client_t * client, dfc_request_t * req)
 {
     struct list_head * item;
     dfc_sort_t * sort;
 
+    __dfc_client_skip(client);
     while (client->next_receive == (req->seq & INT64_MAX))
     {
         if (!req->sorted)
@@ -1256,6 +2864,8 @@ void __dfc_serialize(dfc_client_t * client, dfc_request_t * req)
         }
 
         req->ready = true;
+        req->time_sorted = dfc_time();
+        DFC_PROBE(serialize, client->index, req->txn, req->seq & INT64_MAX);
 
         sort = req->sort;
         if (!req->completed && !sys_delay_cancel(req->delay, false))
@@ -1272,18 +2882,23 @@ void __dfc_serialize(dfc_client_t * client, dfc_request_t * req)
             break;
         }
         req = list_entry(item, dfc_request_t, sequence_list);
+
+        __dfc_client_skip(client);
     }
 }
 
-err_t dfc_sort_parse(dfc_client_t * client, void * sort, size_t size)
+err_t dfc_sort_parse(dfc_client_t * client, data_t * sort)
 {
     dfc_request_t * req;
     void * ptr, * data;
     int64_t txn, idx;
-    size_t bsize;
+    size_t size, bsize;
     uint32_t length;
 
-    ptr = sort;
+    atomic_add(&client->dfc->stats.sort_in, sort->len, memory_order_relaxed);
+
+    ptr = sort->data;
+    size = sort->len;
     while (size > 0)
     {
         SYS_CALL(
@@ -1300,12 +2915,12 @@ err_t dfc_sort_parse(dfc_client_t * client, void * sort, size_t size)
         );
 
         req = NULL;
-        idx = (txn >> 8) & client->txn_mask;
+        idx = (txn >> DFC_TXN_SHIFT) & client->txn_mask;
         if (!list_empty(&client->requests[idx]))
         {
             req = list_entry(client->requests[idx].next, dfc_request_t,
                              ready_pending_list);
-            if (((req->txn ^ txn) >> 8) != 0)
+            if (((req->txn ^ txn) >> DFC_TXN_SHIFT) != 0)
             {
                 req = NULL;
             }
@@ -1324,43 +2939,46 @@ err_t dfc_sort_parse(dfc_client_t * client, void * sort, size_t size)
         }
 
         req->sorted = true;
+        dfc_trace(req, DFC_EVENT_SORT, NULL);
 
         __dfc_serialize(client, req);
     }
 
-    SYS_FREE(sort);
+    data_unref(sort);
 
     return 0;
 }
 
 SYS_LOCK_CREATE(dfc_sort_client_recv, ((dfc_client_t *, client),
                                        (call_frame_t *, frame),
-                                       (int64_t *, txn), (void *, data),
-                                       (size_t, size)))
+                                       (int64_t *, txn), (data_t *, data),
+                                       (dfc_channel_t *, channel)))
 {
-    dfc_sort_t * sort;
+    struct list_head list;
     dfc_request_t * req;
 
     SYS_CALL(
-        dfc_sort_parse, (client, data, size),
+        dfc_sort_parse, (client, data),
         E()
     );
 
-    if (!list_empty(&client->sort_pending))
+    if (channel != NULL)
     {
-        sort = list_entry(client->sort_pending.next, dfc_sort_t, list);
-        list_del_init(&sort->list);
-
-        dfc_sort_unwind(frame, sort);
-
-        if (client->sort == sort)
-        {
-            dfc_sort_initialize(sort);
-        }
-        else
+        if (client->channel == NULL)
         {
-            SYS_FREE(sort);
+            __dfc_client_bind(client, channel);
         }
+
+        SYS_LOCK(&channel->lock, dfc_channel_recv, (channel, frame));
+    }
+    else if (!list_empty(&client->sort_pending))
+    {
+        INIT_LIST_HEAD(&list);
+        dfc_sort_collect(&client->sort_pending, &list, 0);
+
+        dfc_sort_unwind(frame, DFC_XATTR_SORT, &list, false);
+
+        dfc_sort_done_list(client, &list);
     }
     else
     {
@@ -1369,9 +2987,42 @@ SYS_LOCK_CREATE(dfc_sort_client_recv, ((dfc_client_t *, client),
         req->client = client;
         req->frame = frame;
         list_add_tail(&req->sort_pending_list, &client->sort_slots);
+        client->slots++;
     }
 
     SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
+
+err_t dfc_sort_client_queue(dfc_client_t * client, dfc_dependencies_t * deps)
+{
+    dfc_sort_t * sort;
+
+    sort = client->sort;
+    if ((sort == NULL) || (!sort->pending && (sort->length >= DFC_SORT_MAX)))
+    {
+        SYS_CALL(
+            dfc_sort_create, (client),
+            E(),
+            RETERR()
+        );
+        sort = client->sort;
+    }
+    SYS_CALL(
+        dfc_sort_add_block, (client->dfc, sort, deps->data,
+                             deps->head - (void *)deps->data),
+        E(),
+        RETERR()
+    );
+
+    dfc_sort_adapt(client);
+    if (sort->pending)
+    {
+        dfc_sort_client_batch(client, sort);
+    }
+
+    return 0;
 }
 
 SYS_LOCK_CREATE(dfc_sort_client_add, ((dfc_request_t *, req)))
@@ -1379,15 +3030,16 @@ SYS_LOCK_CREATE(dfc_sort_client_add, ((dfc_request_t *, req)))
     dfc_dependencies_t deps;
     dfc_client_t * client;
     dfc_request_t * tmp, * aux;
-    dfc_sort_t * sort;
     struct list_head * item;
     int64_t id, seq;
-    err_t error = ENOBUFS;
+    err_t error;
     int32_t idx;
+    bool sorted;
 
     client = req->client;
+    sorted = false;
 
-    id = req->txn >> 8;
+    id = req->txn >> DFC_TXN_SHIFT;
     idx = id & client->txn_mask;
     item = &client->requests[idx];
     tmp = NULL;
@@ -1397,49 +3049,42 @@ SYS_LOCK_CREATE(dfc_sort_client_add, ((dfc_request_t *, req)))
         do
         {
             tmp = list_entry(item, dfc_request_t, ready_pending_list);
-            if ((tmp->txn >> 8) <= id)
+            if ((tmp->txn >> DFC_TXN_SHIFT) <= id)
             {
                 break;
             }
             item = item->prev;
         } while (item != &client->requests[idx]);
     }
-    if ((tmp == NULL) || ((tmp->txn >> 8) != id))
+    if ((tmp == NULL) || ((tmp->txn >> DFC_TXN_SHIFT) != id))
     {
         SYS_CALL(
             dfc_dependency_build, (&deps, req),
             E(),
-            GOTO(failed)
+            GOTO(failed_deps, &error)
         );
 
-        sort = client->sort;
-        if (sort != NULL)
+        if (req->complete)
         {
-            error = sys_buf_set_block(&sort->head, &sort->size, deps.data,
-                                      sizeof(deps.data) - deps.size);
+            // Nothing will be added by the client. Local dependencies are
+            // used directly.
+            if (dfc_request_prepare(client->dfc, req, deps.buffer,
+                                    deps.head - deps.buffer) != 0)
+            {
+                req->bad = true;
+            }
+            sorted = true;
         }
-        if (error != 0)
+        else
         {
             SYS_CALL(
-                dfc_sort_create, (client),
-                E(),
-                GOTO(failed, &error)
-            );
-            sort = client->sort;
-            SYS_CALL(
-                sys_buf_set_block, (&sort->head, &sort->size, deps.data,
-                                    sizeof(deps.data) - deps.size),
+                dfc_sort_client_queue, (client, &deps),
                 E(),
-                GOTO(failed, &error)
+                GOTO(failed_deps, &error)
             );
         }
 
-        if (sort->pending)
-        {
-            sort->pending = false;
-            // Delay send to allow other requests to be accumulated.
-            SYS_LOCK(&client->lock, dfc_sort_client_send, (client, sort));
-        }
+        dfc_dependency_release(&deps);
 
         list_add(&req->ready_pending_list, item);
     }
@@ -1486,6 +3131,12 @@ SYS_LOCK_CREATE(dfc_sort_client_add, ((dfc_request_t *, req)))
             } while (aux->seq == seq);
             client->next_seq = seq;
         }
+
+        if (sorted)
+        {
+            req->sorted = true;
+            __dfc_serialize(client, req);
+        }
     }
     else
     {
@@ -1506,7 +3157,9 @@ SYS_LOCK_CREATE(dfc_sort_client_add, ((dfc_request_t *, req)))
 
     return;
 
-failed:
+failed_deps:
+    dfc_dependency_release(&deps);
+
     SYS_UNLOCK(&client->lock);
 
     req->bad = true;
@@ -1514,6 +3167,14 @@ failed:
     sys_delay_execute(req->delay, error);
 }
 
+// Fields of a DFC request found by dfc_analyze().
+#define DFC_FIELD_UUID   0x01
+#define DFC_FIELD_ID     0x02
+#define DFC_FIELD_SORT   0x04
+#define DFC_FIELD_OFFSET 0x08
+#define DFC_FIELD_SIZE   0x10
+#define DFC_FIELD_DEPS   0x20
+
 err_t dfc_analyze_xattr(uint32_t * mask, uint32_t value, err_t error)
 {
     if ((error == 0) || (error == ENOENT))
@@ -1530,26 +3191,27 @@ err_t dfc_analyze_xattr(uint32_t * mask, uint32_t value, err_t error)
 }
 
 err_t dfc_analyze(dfc_manager_t * dfc, dict_t ** xdata, uuid_t uuid,
-                  int64_t * txn, void ** sort, size_t * size,
-                  off_t * aux_offs, size_t * aux_size)
+                  int64_t * txn, data_t ** sort, off_t * aux_offs,
+                  size_t * aux_size, bool * complete)
 {
+    data_t * data;
     size_t length;
     uint32_t mask;
-    uint8_t data[1024];
 
     mask = 0;
 
     SYS_CALL(
-        dfc_analyze_xattr, (&mask, 1, sys_dict_del_block(xdata, DFC_XATTR_UUID,
-                                                         uuid,
-                                                         sizeof(uuid_t))),
+        dfc_analyze_xattr, (&mask, DFC_FIELD_UUID,
+                            sys_dict_del_block(xdata, DFC_XATTR_UUID, uuid,
+                                               sizeof(uuid_t))),
         E(),
         RETVAL(EINVAL)
     );
     length = sizeof(int64_t) * 2;
     SYS_CALL(
-        dfc_analyze_xattr, (&mask, 2, sys_dict_del_bin(xdata, DFC_XATTR_ID,
-                                                       txn, &length)),
+        dfc_analyze_xattr, (&mask, DFC_FIELD_ID,
+                            sys_dict_del_bin(xdata, DFC_XATTR_ID, txn,
+                                             &length)),
         E(),
         RETVAL(EINVAL)
     );
@@ -1561,61 +3223,80 @@ err_t dfc_analyze(dfc_manager_t * dfc, dict_t ** xdata, uuid_t uuid,
     );
     txn[0] = ntoh64(txn[0]);
     txn[1] = ntoh64(txn[1]);
-    length = sizeof(data);
-    SYS_CALL(
-        dfc_analyze_xattr, (&mask, 4, sys_dict_del_bin(xdata, DFC_XATTR_SORT,
-                                                       data, &length)),
-        E(),
-        RETVAL(EINVAL)
-    );
+
+    // Sort data is not copied. A reference to the dict value is kept and
+    // passed to the parser.
+    data = NULL;
+    if (*xdata != NULL)
+    {
+        data = dict_get(*xdata, DFC_XATTR_SORT);
+        if (data != NULL)
+        {
+            data_ref(data);
+            dict_del(*xdata, DFC_XATTR_SORT);
+            mask |= DFC_FIELD_SORT;
+        }
+
+        // The client already knows that the dependencies computed here
+        // will be the final ones.
+        if (dict_get(*xdata, DFC_XATTR_DEPS) != NULL)
+        {
+            dict_del(*xdata, DFC_XATTR_DEPS);
+            mask |= DFC_FIELD_DEPS;
+        }
+    }
 
     *aux_offs = -1;
     SYS_CALL(
-        dfc_analyze_xattr, (&mask, 8, sys_dict_del_int64(xdata,
-                                                         DFC_XATTR_OFFSET,
-                                                         aux_offs)),
+        dfc_analyze_xattr, (&mask, DFC_FIELD_OFFSET,
+                            sys_dict_del_int64(xdata, DFC_XATTR_OFFSET,
+                                               aux_offs)),
         E(),
-        RETVAL(EINVAL)
+        GOTO(failed)
     );
     *aux_size = -1;
     SYS_CALL(
-        dfc_analyze_xattr, (&mask, 16, sys_dict_del_uint64(xdata,
-                                                           DFC_XATTR_SIZE,
-                                                           aux_size)),
+        dfc_analyze_xattr, (&mask, DFC_FIELD_SIZE,
+                            sys_dict_del_uint64(xdata, DFC_XATTR_SIZE,
+                                                aux_size)),
         E(),
-        RETVAL(EINVAL)
+        GOTO(failed)
     );
 
-    if ((mask & 7) == 0)
+    if ((mask & (DFC_FIELD_UUID | DFC_FIELD_ID | DFC_FIELD_SORT)) == 0)
     {
         return ENOENT;
     }
-    if ((mask & 3) != 3)
+    if ((mask & (DFC_FIELD_UUID | DFC_FIELD_ID)) !=
+        (DFC_FIELD_UUID | DFC_FIELD_ID))
     {
         logE("Invalid DFC request.");
 
-        return EINVAL;
+        goto failed;
     }
-    if ((mask & 4) != 0)
+    if ((mask & DFC_FIELD_SORT) != 0)
     {
         if (sort == NULL)
         {
             logE("Unexpected DFC sort request.");
 
-            return EINVAL;
+            goto failed;
         }
 
-        *size = length;
-        SYS_ALLOC(
-            sort, length, sys_mt_uint8_t,
-            E(),
-            RETVAL(EINVAL)
-        );
-
-        memcpy(*sort, data, length);
+        *sort = data;
     }
+    // Dependencies are only final if no sort data needs to be merged.
+    *complete = (mask & (DFC_FIELD_SORT | DFC_FIELD_DEPS)) == DFC_FIELD_DEPS;
 
     return 0;
+
+failed:
+    if (data != NULL)
+    {
+        data_unref(data);
+    }
+
+    return EINVAL;
 }
 
 void dfc_sort_client_process(dfc_request_t * req)
@@ -1652,6 +3333,9 @@ SYS_LOCK_CREATE(__dfc_sort_client_process_timeout, ((dfc_request_t *, req)))
     req->ready = true;
     req->bad = true;
 
+    atomic_inc(&req->client->dfc->stats.timed_out, memory_order_relaxed);
+    dfc_trace(req, DFC_EVENT_TIMEOUT, NULL);
+
     dfc_sort_client_process(req);
 }
 
@@ -1667,12 +3351,18 @@ SYS_LOCK_CREATE(dfc_managed, ((dfc_manager_t *, dfc), (dfc_request_t *, req),
 {
     dfc_client_t * client;
 
+    req->client = NULL;
     SYS_CALL(
         dfc_client_get, (dfc, uuid, &client),
         E(),
         LOG(E(), "DFC client not found. Rejecting request."),
         GOTO(failed)
     );
+    client->last = time(NULL);
+    if (!req->fake)
+    {
+        atomic_inc(&dfc->stats.admitted, memory_order_relaxed);
+    }
 
     req->client = client;
     req->link2.request = req->link1.request = req;
@@ -1696,6 +3386,14 @@ SYS_LOCK_CREATE(dfc_managed, ((dfc_manager_t *, dfc), (dfc_request_t *, req),
     req->sort = NULL;
     req->sort_size = -1;
 
+    if (!req->fake)
+    {
+        dfc_trace(req, DFC_EVENT_ADMIT, req->link1.inode);
+        DFC_PROBE(managed, client->index, req->txn, req->seq & INT64_MAX,
+                  DFC_GFID(req->link1.inode), DFC_GFID(req->link2.inode),
+                  req->fop);
+    }
+
     req->delay = SYS_DELAY(2000, dfc_sort_client_process_timeout, (req), 1);
     SYS_LOCK(&client->lock, dfc_sort_client_add, (req));
 
@@ -1706,12 +3404,108 @@ SYS_LOCK_CREATE(dfc_managed, ((dfc_manager_t *, dfc), (dfc_request_t *, req),
 failed:
     SYS_UNLOCK(&dfc->lock);
 
+    atomic_inc(&dfc->stats.bad, memory_order_relaxed);
     sys_gf_unwind_error(req->frame, EUCLEAN, NULL, NULL, NULL, (uintptr_t *)req,
                         (uintptr_t *)req + DFC_REQ_SIZE);
 
     dfc_request_free(req);
 }
 
+SYS_CBK_CREATE(dfc_init_cbk, io, ((dfc_manager_t *, dfc)))
+{
+    SYS_GF_WIND_CBK_TYPE(lookup) * args;
+    uint8_t info[sizeof(uuid_t) + sizeof(int64_t)];
+    void * ptr;
+
+    // Tell the client which process this brick belongs to, so that it can
+    // use a single sort channel for all bricks of the same process.
+    args = (SYS_GF_WIND_CBK_TYPE(lookup) *)io;
+    if (args->op_ret >= 0)
+    {
+        ptr = info;
+        __sys_buf_set_uuid(&ptr, dfc_process_uuid);
+        __sys_buf_set_int64(&ptr, dfc->brick);
+        SYS_CALL(
+            sys_dict_set_bin, (&args->xdata, DFC_XATTR_PROCESS, info,
+                               sizeof(info), NULL),
+            E()
+        );
+
+        // The client is already registered. Any request received from now
+        // on will be accepted, so the client can start using this brick
+        // as soon as it receives this reply.
+        SYS_CALL(
+            sys_dict_set_bin, (&args->xdata, DFC_XATTR_READY, info, 0, NULL),
+            E()
+        );
+        SYS_CALL(
+            sys_dict_set_uint64, (&args->xdata, DFC_XATTR_FEATURES,
+                                  DFC_FEATURE_DEPS, NULL),
+            E()
+        );
+    }
+
+    sys_gf_handler_call_lookup_unwind(NULL, 0, 0, NULL, NULL, io);
+}
+
+SYS_LOCK_CREATE(dfc_client_bind, ((dfc_client_t *, client),
+                                  (dfc_channel_t *, channel)))
+{
+    __dfc_client_bind(client, channel);
+
+    SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
+
+SYS_LOCK_CREATE(dfc_client_resume, ((dfc_client_t *, client),
+                                    (dfc_channel_t *, channel),
+                                    (int64_t, txn), (int64_t, seq)))
+{
+    dfc_request_t * req;
+
+    // The new connection may not use the shared channel.
+    client->channel = NULL;
+    client->resume_txn = txn;
+    client->resume_seq = seq;
+    if (list_empty(&client->sequence) && (client->next_txn <= txn))
+    {
+        client->next_txn = txn + (1LL << DFC_TXN_SHIFT);
+    }
+
+    // Sort requests of the previous connection cannot be answered anymore.
+    while (!list_empty(&client->sort_slots))
+    {
+        req = list_entry(client->sort_slots.next, dfc_request_t,
+                         sort_pending_list);
+        list_del_init(&req->sort_pending_list);
+        client->slots--;
+
+        if (sys_delay_cancel((uintptr_t *)req, false))
+        {
+            SYS_IO(sys_gf_getxattr_unwind, (req->frame, 0, 0, NULL, NULL),
+                   NULL);
+        }
+    }
+    __dfc_client_bind(client, channel);
+
+    // Requests waiting for a lost one can be processed now.
+    __dfc_client_skip(client);
+    list_for_each_entry(req, &client->sequence, sequence_list)
+    {
+        if ((req->seq & INT64_MAX) == client->next_receive)
+        {
+            __dfc_serialize(client, req);
+
+            break;
+        }
+    }
+
+    SYS_UNLOCK(&client->lock);
+
+    dfc_client_put(client);
+}
+
 SYS_LOCK_CREATE(dfc_init_handler, ((dfc_manager_t *, dfc),
                                    (call_frame_t *, frame),
                                    (xlator_t *, xl),
@@ -1722,28 +3516,81 @@ SYS_LOCK_CREATE(dfc_init_handler, ((dfc_manager_t *, dfc),
                                    (dict_t *, xdata, COPY, sys_dict_acquire,
                                                            sys_dict_release)))
 {
+    uint8_t info[sizeof(int64_t) * 2];
     dfc_client_t * client;
+    dfc_channel_t * channel;
+    int64_t resume_txn, resume_seq;
+    void * ptr;
+    size_t len;
+    bool found;
+
+    __dfc_client_sweep(dfc);
 
     SYS_CALL(
-        __dfc_client_add, (dfc, uuid, txn, &client),
+        __dfc_client_add, (dfc, uuid, txn, &client, &found),
         E(),
         GOTO(failed)
     );
 
-    client->next_txn = 1;
-    client->next_seq = 1;
+    // Older clients do not advertise any feature.
+    client->features = 0;
+    sys_dict_del_uint64(&xdata, DFC_XATTR_FEATURES, &client->features);
+
+    // Clients using multiplexed polls only poll one brick of each process,
+    // so sort data of this brick must use the shared channel from the start.
+    channel = NULL;
+    if ((client->features & DFC_FEATURE_MUX) != 0)
+    {
+        SYS_CALL(
+            dfc_channel_get, (uuid, &channel),
+            E(),
+            GOTO(failed_client)
+        );
+    }
+
+    // A known client reconnecting tells which was the last transaction and
+    // sequence number sent before the disconnection. Its state is kept so
+    // that requests already received can continue.
+    len = sizeof(info);
+    if (found && (xdata != NULL) &&
+        (sys_dict_get_bin(xdata, DFC_XATTR_RESUME, info, &len) == 0) &&
+        (len == sizeof(info)))
+    {
+        dict_del(xdata, DFC_XATTR_RESUME);
+
+        ptr = info;
+        resume_txn = __sys_buf_get_int64(&ptr);
+        resume_seq = __sys_buf_get_int64(&ptr);
 
-    SYS_UNLOCK(&dfc->lock);
+        SYS_UNLOCK(&dfc->lock);
 
-    dfc_client_put(client);
+        SYS_LOCK(&client->lock, dfc_client_resume,
+                 (client, channel, resume_txn, resume_seq));
+    }
+    else
+    {
+        if (xdata != NULL)
+        {
+            dict_del(xdata, DFC_XATTR_RESUME);
+        }
+
+        client->next_txn = 1;
+        client->next_seq = 1;
+
+        SYS_UNLOCK(&dfc->lock);
+
+        SYS_LOCK(&client->lock, dfc_client_bind, (client, channel));
+    }
 
     SYS_IO(
-        sys_gf_lookup_wind_tail, (frame, FIRST_CHILD(xl), loc, xdata),
-        NULL, NULL
+        sys_gf_lookup_wind, (frame, NULL, FIRST_CHILD(xl), loc, xdata),
+        SYS_CBK(dfc_init_cbk, (dfc)), NULL
     );
 
     return;
 
+failed_client:
+    dfc_client_put(client);
 failed:
     SYS_UNLOCK(&dfc->lock);
 
@@ -1754,22 +3601,39 @@ failed:
 }
 
 void dfc_sort_handler(dfc_manager_t * dfc, call_frame_t * frame, xlator_t * xl,
-                      uuid_t uuid, int64_t * txn, void * sort, size_t size)
+                      uuid_t uuid, int64_t * txn, data_t * sort, bool mux)
 {
     dfc_client_t * client;
+    dfc_channel_t * channel;
 
     SYS_CALL(
         dfc_client_get, (dfc, uuid, &client),
         E(),
         GOTO(failed)
     );
+    client->last = time(NULL);
+
+    channel = NULL;
+    if (mux)
+    {
+        SYS_CALL(
+            dfc_channel_get, (uuid, &channel),
+            E(),
+            GOTO(failed_client)
+        );
+    }
 
+    // The reference is released once the request has been processed.
     SYS_LOCK(&client->lock,
-             dfc_sort_client_recv, (client, frame, txn, sort, size));
+             dfc_sort_client_recv, (client, frame, txn, sort, channel));
 
     return;
 
+failed_client:
+    dfc_client_put(client);
 failed:
+    data_unref(sort);
+
     SYS_IO(sys_gf_getxattr_unwind_error, (frame, EUCLEAN, NULL), NULL);
 }
 
@@ -1806,6 +3670,8 @@ void dfc_update_size_xattr(call_frame_t * frame, xlator_t * xl, fd_t * fd,
     {
         goto done;
     }
+    DFC_PROBE(update_size, DFC_GFID((fd != NULL) ? fd->inode : loc->inode),
+              inode->size, new_size);
 
     dict = NULL;
     SYS_CALL(
@@ -1915,6 +3781,7 @@ SYS_CBK_DEFINE(dfc_update_size_xattr_fcbk, io,
                 piatt->ia_size = req->size; \
             } \
         } \
+        dfc_sort_piggyback(req, &args->xdata); \
     }
 
 void dfc_managed_readdir_update(dfc_request_t * req, uintptr_t * data)
@@ -1935,6 +3802,8 @@ void dfc_managed_readdir_update(dfc_request_t * req, uintptr_t * data)
             }
         }
     }
+
+    dfc_sort_piggyback(req, &args->xdata);
 }
 
 void dfc_managed_readdirp_update(dfc_request_t * req, uintptr_t * data)
@@ -1955,6 +3824,8 @@ void dfc_managed_readdirp_update(dfc_request_t * req, uintptr_t * data)
             }
         }
     }
+
+    dfc_sort_piggyback(req, &args->xdata);
 }
 
 DFC_UPDATE(access,       ,          ,                        )
@@ -1997,34 +3868,212 @@ DFC_UPDATE(writev,       ,          prebuf,      postbuf     )
 DFC_UPDATE(xattrop,      ,          ,                        )
 DFC_UPDATE(fxattrop,     ,          ,                        )
 
+static const char * dfc_event_names[DFC_EVENT_COUNT] =
+{
+    [DFC_EVENT_ADMIT]    = "admit",
+    [DFC_EVENT_SORT]     = "sort",
+    [DFC_EVENT_DEPEND]   = "depend",
+    [DFC_EVENT_CYCLE]    = "cycle",
+    [DFC_EVENT_TIMEOUT]  = "timeout",
+    [DFC_EVENT_EXECUTE]  = "execute",
+    [DFC_EVENT_BAD]      = "bad",
+    [DFC_EVENT_COMPLETE] = "complete"
+};
+
+int32_t dfc_event_print(char * buffer, size_t size, dfc_event_t * event)
+{
+    char gfid[64];
+
+    uuid_unparse(event->gfid, gfid);
+
+    return snprintf(buffer, size, "%lu %s client=%d txn=%ld seq=%ld gfid=%s",
+                    event->time, dfc_event_names[event->type], event->client,
+                    event->txn, event->seq, gfid);
+}
+
+// Returns the newest events of the trace, one per line.
+void dfc_trace_unwind(dfc_manager_t * dfc, call_frame_t * frame)
+{
+    dfc_event_t * events;
+    dict_t * dict;
+    char * data;
+    size_t size, length;
+    uint32_t i, count;
+
+    SYS_CALL(
+        dfc_trace_collect, (dfc, DFC_TRACE_XATTR, &events, &count),
+        E(),
+        GOTO(failed)
+    );
+
+    SYS_PTR(
+        &dict, dict_new, (),
+        ENOMEM,
+        E(),
+        GOTO(failed_events)
+    );
+
+    // Each line is followed by a new line character.
+    size = 1;
+    for (i = 0; i < count; i++)
+    {
+        size += dfc_event_print(NULL, 0, &events[i]) + 1;
+    }
+    SYS_PTR(
+        &data, GF_MALLOC, (size, gf_common_mt_char),
+        ENOMEM,
+        E(),
+        GOTO(failed_dict)
+    );
+    length = 0;
+    data[0] = 0;
+    for (i = 0; i < count; i++)
+    {
+        length += dfc_event_print(data + length, size - length, &events[i]);
+        data[length++] = '\n';
+        data[length] = 0;
+    }
+
+    if (dict_set_dynstr(dict, DFC_XATTR_TRACE, data) != 0)
+    {
+        GF_FREE(data);
+
+        goto failed_dict;
+    }
+
+    SYS_IO(sys_gf_getxattr_unwind, (frame, length + 1, 0, dict, NULL), NULL);
+
+    dict_unref(dict);
+    SYS_FREE(events);
+
+    return;
+
+failed_dict:
+    dict_unref(dict);
+failed_events:
+    SYS_FREE(events);
+failed:
+    SYS_IO(sys_gf_getxattr_unwind_error, (frame, ENOMEM, NULL), NULL);
+}
+
+// Returns a snapshot of the counters of this brick as a JSON object. Data
+// shared by all bricks of the process is reported in the 'process' member.
+void dfc_stats_unwind(dfc_manager_t * dfc, call_frame_t * frame)
+{
+    dfc_client_t * client;
+    dfc_channel_t * channel;
+    dict_t * dict;
+    char * data;
+    uint64_t slots, parked;
+    uint32_t bricks, channels;
+    int32_t i, length;
+
+    // Polls multiplexed through the shared channels are parked there, not in
+    // any brick.
+    parked = 0;
+    channels = 0;
+
+    pthread_mutex_lock(&dfc_process_lock);
+
+    bricks = dfc_process_count;
+    list_for_each_entry(channel, &dfc_process_channels, list)
+    {
+        parked += channel->parked;
+        channels++;
+    }
+
+    pthread_mutex_unlock(&dfc_process_lock);
+
+    slots = 0;
+
+    sys_rcu_read_lock();
+
+    for (i = 0; i < 256; i++)
+    {
+        client = sys_rcu_dereference(dfc->clients[i]);
+        while (client != NULL)
+        {
+            slots += client->slots;
+            client = sys_rcu_dereference(client->next);
+        }
+    }
+
+    sys_rcu_read_unlock();
+
+    SYS_PTR(
+        &dict, dict_new, (),
+        ENOMEM,
+        E(),
+        GOTO(failed)
+    );
+
+    length = gf_asprintf(&data,
+                         "{\"brick\":%u,\"admitted\":%lu,\"bypassed\":%lu,"
+                         "\"timed-out\":%lu,\"cycles-broken\":%lu,"
+                         "\"bad\":%lu,\"sort-bytes-in\":%lu,"
+                         "\"sort-bytes-out\":%lu,\"parked-slots\":%lu,"
+                         "\"clients\":%u,\"linked-inodes\":%lu,"
+                         "\"pool-segments\":%u,\"pool-size\":%u,"
+                         "\"process\":{\"bricks\":%u,\"channels\":%u,"
+                         "\"parked-slots\":%lu}}",
+                         dfc->brick, dfc->stats.admitted, dfc->stats.bypassed,
+                         dfc->stats.timed_out, dfc->stats.cycles,
+                         dfc->stats.bad, dfc->stats.sort_in,
+                         dfc->stats.sort_out, slots, dfc->client_count,
+                         dfc->stats.inodes, dfc->segment_count,
+                         DFC_SEGMENT_POOL, bricks, channels, parked);
+    if (length < 0)
+    {
+        goto failed_dict;
+    }
+    if (dict_set_dynstr(dict, DFC_XATTR_STATS, data) != 0)
+    {
+        GF_FREE(data);
+
+        goto failed_dict;
+    }
+
+    SYS_IO(sys_gf_getxattr_unwind, (frame, length + 1, 0, dict, NULL), NULL);
+
+    dict_unref(dict);
+
+    return;
+
+failed_dict:
+    dict_unref(dict);
+failed:
+    SYS_IO(sys_gf_getxattr_unwind_error, (frame, ENOMEM, NULL), NULL);
+}
+
 #define DFC_CHECK(_fop) \
     static inline err_t dfc_check_##_fop(dfc_manager_t * dfc, \
                                          call_frame_t * frame, xlator_t * xl, \
                                          dict_t ** xdata, uuid_t uuid, \
                                          int64_t * txn, off_t * aux_offs, \
-                                         size_t * aux_size, loc_t * loc) \
+                                         size_t * aux_size, bool * complete, \
+                                         loc_t * loc, const char * name) \
     { \
-        return dfc_analyze(dfc, xdata, uuid, txn, NULL, NULL, aux_offs, \
-                           aux_size); \
+        return dfc_analyze(dfc, xdata, uuid, txn, NULL, aux_offs, aux_size, \
+                           complete); \
     }
 
 static inline err_t dfc_check_lookup(dfc_manager_t * dfc, call_frame_t * frame,
                                      xlator_t * xl, dict_t ** xdata,
                                      uuid_t uuid, int64_t * txn,
                                      off_t * aux_offs, size_t * aux_size,
-                                     loc_t * loc)
+                                     bool * complete, loc_t * loc,
+                                     const char * name)
 {
-    void * sort;
-    size_t size;
+    data_t * sort;
     err_t error;
 
     sort = NULL;
-    error = dfc_analyze(dfc, xdata, uuid, txn, &sort, &size, aux_offs,
-                        aux_size);
+    error = dfc_analyze(dfc, xdata, uuid, txn, &sort, aux_offs, aux_size,
+                        complete);
 
     if ((error == 0) && (sort != NULL))
     {
-        SYS_FREE(sort);
+        data_unref(sort);
         if ((loc->name == NULL) && (strcmp(loc->path, "/") == 0))
         {
             logT("DFC(lookup) init");
@@ -2039,13 +4088,6 @@ static inline err_t dfc_check_lookup(dfc_manager_t * dfc, call_frame_t * frame,
         return EINVAL;
     }
 
-    if (sort != NULL)
-    {
-        SYS_FREE(sort);
-
-        return EINVAL;
-    }
-
     return error;
 }
 
@@ -2053,20 +4095,45 @@ static inline err_t dfc_check_getxattr(dfc_manager_t * dfc,
                                        call_frame_t * frame, xlator_t * xl,
                                        dict_t ** xdata, uuid_t uuid,
                                        int64_t * txn, off_t * aux_offs,
-                                       size_t * aux_size, loc_t * loc)
+                                       size_t * aux_size, bool * complete,
+                                       loc_t * loc, const char * name)
 {
-    void * sort;
-    size_t size;
+    data_t * sort;
     err_t error;
+    bool mux;
+
+    // Statistics are answered directly. They do not need to be ordered with
+    // other requests.
+    if ((name != NULL) && (strcmp(name, DFC_XATTR_STATS) == 0))
+    {
+        logT("DFC(getxattr) stats");
+        dfc_stats_unwind(dfc, frame);
+
+        return EALREADY;
+    }
+    if ((name != NULL) && (strcmp(name, DFC_XATTR_TRACE) == 0))
+    {
+        logT("DFC(getxattr) trace");
+        dfc_trace_unwind(dfc, frame);
+
+        return EALREADY;
+    }
+
+    mux = false;
+    if ((*xdata != NULL) && (dict_get(*xdata, DFC_XATTR_MUX) != NULL))
+    {
+        dict_del(*xdata, DFC_XATTR_MUX);
+        mux = true;
+    }
 
     sort = NULL;
-    error = dfc_analyze(dfc, xdata, uuid, txn, &sort, &size, aux_offs,
-                        aux_size);
+    error = dfc_analyze(dfc, xdata, uuid, txn, &sort, aux_offs, aux_size,
+                        complete);
 
     if ((error == 0) && (sort != NULL))
     {
         logT("DFC(getxattr) sort");
-        dfc_sort_handler(dfc, frame, xl, uuid, txn, sort, size);
+        dfc_sort_handler(dfc, frame, xl, uuid, txn, sort, mux);
 
         if (txn[0] == 0)
         {
@@ -2076,13 +4143,6 @@ static inline err_t dfc_check_getxattr(dfc_manager_t * dfc,
         return EBUSY;
     }
 
-    if (sort != NULL)
-    {
-        SYS_FREE(sort);
-
-        return EINVAL;
-    }
-
     return error;
 }
 
@@ -2126,7 +4186,7 @@ DFC_CHECK(writev)
 DFC_CHECK(xattrop)
 DFC_CHECK(fxattrop)
 
-#define DFC_MANAGE(_fop, _ro, _fd, _loc, _inode1, _inode2, _inode3) \
+#define DFC_MANAGE(_fop, _ro, _fd, _loc, _name, _inode1, _inode2, _inode3) \
     SYS_ASYNC_CREATE(dfc_managed_##_fop, ((call_frame_t *, frame), \
                                           (xlator_t *, xl), \
                                           SYS_GF_ARGS_##_fop)) \
@@ -2136,10 +4196,14 @@ DFC_CHECK(fxattrop)
         int64_t txn[2]; \
         off_t aux_offs; \
         size_t aux_size; \
+        bool complete; \
         dfc_manager_t * dfc = xl->private; \
+        uint64_t arrival = dfc_time(); \
         sys_dict_acquire(&xdata, xdata); \
+        complete = false; \
         err_t error = dfc_check_##_fop(dfc, frame, xl, &xdata, uuid, txn, \
-                                       &aux_offs, &aux_size, _loc); \
+                                       &aux_offs, &aux_size, &complete, _loc, \
+                                       _name); \
         if (error != EALREADY) \
         { \
             req = (dfc_request_t *)SYS_GF_FOP(_fop, DFC_REQ_SIZE); \
@@ -2147,6 +4211,11 @@ DFC_CHECK(fxattrop)
             req->xl = xl; \
             req->txn = txn[0]; \
             req->seq = txn[1]; \
+            req->fop = frame->root->op; \
+            req->time_arrival = arrival; \
+            req->time_sorted = 0; \
+            req->time_ready = 0; \
+            req->time_wind = 0; \
             req->aux_offs = aux_offs; \
             req->aux_size = aux_size; \
             req->ro = _ro; \
@@ -2157,6 +4226,7 @@ DFC_CHECK(fxattrop)
             INIT_LIST_HEAD(&req->sibling_list); \
             req->root = req; \
             req->fake = false; \
+            req->complete = complete; \
             if (error == EBUSY) \
             { \
                 req->fake = true; \
@@ -2177,6 +4247,10 @@ DFC_CHECK(fxattrop)
                 req->link2.inode = NULL; \
                 req->refs = 0; \
                 req->bad = error != ENOENT; \
+                if (!req->bad) \
+                { \
+                    atomic_inc(&dfc->stats.bypassed, memory_order_relaxed); \
+                } \
                 req->started = false; \
                 req->completed = false; \
                 dfc_request_execute(req); \
@@ -2185,48 +4259,48 @@ DFC_CHECK(fxattrop)
         sys_dict_release(xdata); \
     } \
 
-DFC_MANAGE(access,       true,  NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(create,       false, fd,   NULL, NULL,          loc->parent,    NULL)
-DFC_MANAGE(entrylk,      true,  NULL, NULL, NULL,          loc->parent,    NULL)
-DFC_MANAGE(fentrylk,     true,  NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(access,       true,  NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(create,       false, fd,   NULL, NULL, NULL,          loc->parent,    NULL)
+DFC_MANAGE(entrylk,      true,  NULL, NULL, NULL, NULL,          loc->parent,    NULL)
+DFC_MANAGE(fentrylk,     true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
 // TODO: Can flush, fsync and fsyncdir be really considered read-only ?
-DFC_MANAGE(flush,        true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(fsync,        true,  NULL, NULL, fd->inode,     fd->inode,      NULL)
-DFC_MANAGE(fsyncdir,     true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(getxattr,     true,  NULL, loc,  NULL,          loc->inode,     NULL)
-DFC_MANAGE(fgetxattr,    true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(inodelk,      true,  NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(finodelk,     true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(link,         false, NULL, NULL, NULL,          oldloc->inode,  newloc->parent)
-DFC_MANAGE(lk,           true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(lookup,       true,  NULL, loc,  NULL,          loc->parent,    NULL)
-DFC_MANAGE(mkdir,        false, NULL, NULL, NULL,          loc->parent,    NULL)
-DFC_MANAGE(mknod,        false, NULL, NULL, NULL,          loc->parent,    NULL)
-DFC_MANAGE(open,         true,  NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(opendir,      true,  NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(rchecksum,    true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(readdir,      true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(readdirp,     true,  NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(readlink,     true,  NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(readv,        true,  NULL, NULL, fd->inode,     fd->inode,      NULL)
-DFC_MANAGE(removexattr,  false, NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(fremovexattr, false, NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(rename,       false, NULL, NULL, oldloc->inode, oldloc->parent, newloc->parent)
-DFC_MANAGE(rmdir,        false, NULL, NULL, NULL,          loc->parent,    loc->inode)
-DFC_MANAGE(setattr,      false, NULL, NULL, loc->inode,    loc->inode,     NULL)
-DFC_MANAGE(fsetattr,     false, NULL, NULL, fd->inode,     fd->inode,      NULL)
-DFC_MANAGE(setxattr,     false, NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(fsetxattr,    false, NULL, NULL, NULL,          fd->inode,      NULL)
-DFC_MANAGE(stat,         true,  NULL, NULL, loc->inode,    loc->inode,     NULL)
-DFC_MANAGE(fstat,        true,  NULL, NULL, fd->inode,     fd->inode,      NULL)
-DFC_MANAGE(statfs,       true,  NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(symlink,      false, NULL, NULL, NULL,          loc->parent,    NULL)
-DFC_MANAGE(truncate,     false, NULL, loc,  loc->inode,    loc->inode,     NULL)
-DFC_MANAGE(ftruncate,    false, fd,   NULL, fd->inode,     fd->inode,      NULL)
-DFC_MANAGE(unlink,       false, NULL, NULL, NULL,          loc->parent,    loc->inode)
-DFC_MANAGE(writev,       false, fd,   NULL, fd->inode,     fd->inode,      NULL)
-DFC_MANAGE(xattrop,      false, NULL, NULL, NULL,          loc->inode,     NULL)
-DFC_MANAGE(fxattrop,     false, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(flush,        true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(fsync,        true,  NULL, NULL, NULL, fd->inode,     fd->inode,      NULL)
+DFC_MANAGE(fsyncdir,     true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(getxattr,     true,  NULL, loc,  name, NULL,          loc->inode,     NULL)
+DFC_MANAGE(fgetxattr,    true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(inodelk,      true,  NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(finodelk,     true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(link,         false, NULL, NULL, NULL, NULL,          oldloc->inode,  newloc->parent)
+DFC_MANAGE(lk,           true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(lookup,       true,  NULL, loc,  NULL, NULL,          loc->parent,    NULL)
+DFC_MANAGE(mkdir,        false, NULL, NULL, NULL, NULL,          loc->parent,    NULL)
+DFC_MANAGE(mknod,        false, NULL, NULL, NULL, NULL,          loc->parent,    NULL)
+DFC_MANAGE(open,         true,  NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(opendir,      true,  NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(rchecksum,    true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(readdir,      true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(readdirp,     true,  NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(readlink,     true,  NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(readv,        true,  NULL, NULL, NULL, fd->inode,     fd->inode,      NULL)
+DFC_MANAGE(removexattr,  false, NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(fremovexattr, false, NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(rename,       false, NULL, NULL, NULL, oldloc->inode, oldloc->parent, newloc->parent)
+DFC_MANAGE(rmdir,        false, NULL, NULL, NULL, NULL,          loc->parent,    loc->inode)
+DFC_MANAGE(setattr,      false, NULL, NULL, NULL, loc->inode,    loc->inode,     NULL)
+DFC_MANAGE(fsetattr,     false, NULL, NULL, NULL, fd->inode,     fd->inode,      NULL)
+DFC_MANAGE(setxattr,     false, NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(fsetxattr,    false, NULL, NULL, NULL, NULL,          fd->inode,      NULL)
+DFC_MANAGE(stat,         true,  NULL, NULL, NULL, loc->inode,    loc->inode,     NULL)
+DFC_MANAGE(fstat,        true,  NULL, NULL, NULL, fd->inode,     fd->inode,      NULL)
+DFC_MANAGE(statfs,       true,  NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(symlink,      false, NULL, NULL, NULL, NULL,          loc->parent,    NULL)
+DFC_MANAGE(truncate,     false, NULL, loc,  NULL, loc->inode,    loc->inode,     NULL)
+DFC_MANAGE(ftruncate,    false, fd,   NULL, NULL, fd->inode,     fd->inode,      NULL)
+DFC_MANAGE(unlink,       false, NULL, NULL, NULL, NULL,          loc->parent,    loc->inode)
+DFC_MANAGE(writev,       false, fd,   NULL, NULL, fd->inode,     fd->inode,      NULL)
+DFC_MANAGE(xattrop,      false, NULL, NULL, NULL, NULL,          loc->inode,     NULL)
+DFC_MANAGE(fxattrop,     false, NULL, NULL, NULL, NULL,          fd->inode,      NULL)
 
 #define DFC_FOP(_fop, _size) \
     static int32_t dfc_##_fop(call_frame_t * frame, xlator_t * xl, \
@@ -2336,6 +4410,267 @@ static int32_t dfc_releasedir(xlator_t * this, fd_t * fd)
     return 0;
 }
 
+// Statedump helpers. Locks are not taken, so values may be slightly
+// inconsistent, but a stalled brick can still be inspected. The number of
+// dumped entries is limited.
+
+#define DFC_DUMP_CLIENTS 64
+#define DFC_DUMP_LINKS   16
+
+static const char * dfc_latency_names[DFC_LATENCY_COUNT] =
+{
+    [DFC_LATENCY_SORT] = "sort-wait",
+    [DFC_LATENCY_DEPS] = "dependency-wait",
+    [DFC_LATENCY_EXEC] = "execution"
+};
+
+// Only fops that have been seen are dumped. Each non empty bucket is written
+// as '<upper limit in us>:<count>'.
+static void dfc_latency_dump(void)
+{
+    char key[GF_DUMP_MAX_BUF_LEN];
+    char buffer[DFC_LATENCY_BUCKETS * 48];
+    uint64_t hist[DFC_LATENCY_COUNT][DFC_LATENCY_BUCKETS];
+    size_t length;
+    int32_t fop, i, j;
+    bool found;
+
+    for (fop = 0; fop < GF_FOP_MAXVALUE; fop++)
+    {
+        dfc_latency_collect(fop, hist);
+
+        found = false;
+        for (i = 0; i < DFC_LATENCY_COUNT; i++)
+        {
+            length = 0;
+            buffer[0] = 0;
+            for (j = 0; j < DFC_LATENCY_BUCKETS; j++)
+            {
+                if (hist[i][j] != 0)
+                {
+                    length += snprintf(buffer + length,
+                                       sizeof(buffer) - length, "%s%lu:%lu",
+                                       (length == 0) ? "" : " ",
+                                       (j == 0) ? 1UL : 1UL << j,
+                                       hist[i][j]);
+                }
+            }
+            if (length == 0)
+            {
+                continue;
+            }
+
+            if (!found)
+            {
+                gf_proc_dump_build_key(key,
+                                       "xlator.features.dfc.process.latency",
+                                       "%s", gf_fop_list[fop]);
+                gf_proc_dump_add_section(key);
+                found = true;
+            }
+            gf_proc_dump_write(dfc_latency_names[i], "%s", buffer);
+        }
+    }
+}
+
+static void dfc_trace_dump(dfc_manager_t * dfc)
+{
+    char key[GF_DUMP_MAX_BUF_LEN];
+    char buffer[256];
+    dfc_event_t * events;
+    uint32_t i, count;
+
+    if (dfc_trace_collect(dfc, UINT32_MAX, &events, &count) != 0)
+    {
+        return;
+    }
+
+    gf_proc_dump_build_key(key, "xlator.features.dfc", "trace");
+    gf_proc_dump_add_section(key);
+
+    for (i = 0; i < count; i++)
+    {
+        dfc_event_print(buffer, sizeof(buffer), &events[i]);
+        gf_proc_dump_build_key(key, "event", "%u", i);
+        gf_proc_dump_write(key, "%s", buffer);
+    }
+
+    SYS_FREE(events);
+}
+
+// Latency histograms are shared by all bricks of the process, so they are
+// dumped only once, along with the first brick.
+static void dfc_process_dump(dfc_manager_t * dfc)
+{
+    char key[GF_DUMP_MAX_BUF_LEN];
+    char uuid[64];
+    uint32_t bricks;
+    bool first;
+
+    pthread_mutex_lock(&dfc_process_lock);
+
+    first = (dfc_process_managers.next == &dfc->list);
+    bricks = dfc_process_count;
+
+    pthread_mutex_unlock(&dfc_process_lock);
+
+    if (!first)
+    {
+        return;
+    }
+
+    uuid_unparse(dfc_process_uuid, uuid);
+    gf_proc_dump_build_key(key, "xlator.features.dfc", "process");
+    gf_proc_dump_add_section(key);
+
+    gf_proc_dump_write("uuid", "%s", uuid);
+    gf_proc_dump_write("bricks", "%u", bricks);
+
+    dfc_latency_dump();
+}
+
+static int32_t dfc_priv_dump(xlator_t * this)
+{
+    char key[GF_DUMP_MAX_BUF_LEN];
+    char uuid[64];
+    dfc_manager_t * dfc;
+    dfc_client_t * client;
+    int32_t i, count;
+
+    dfc = this->private;
+    if (dfc == NULL)
+    {
+        return 0;
+    }
+
+    gf_proc_dump_build_key(key, "xlator.features.dfc", "priv");
+    gf_proc_dump_add_section(key);
+
+    gf_proc_dump_write("brick", "%u", dfc->brick);
+    gf_proc_dump_write("graph", "%lu", dfc->graph);
+    gf_proc_dump_write("clients", "%u", dfc->client_count);
+    gf_proc_dump_write("segments", "%u", dfc->segment_count);
+    gf_proc_dump_write("sort-batch", "%u bytes, %u blocks, %u ms%s",
+                       dfc->batching.bytes, dfc->batching.count,
+                       dfc->batching.delay,
+                       dfc->batching.adaptive ? ", adaptive" : "");
+    gf_proc_dump_write("client-idle-timeout", "%u", dfc->idle_timeout);
+    gf_proc_dump_write("max-clients", "%u", dfc->max_clients);
+
+    count = 0;
+
+    sys_rcu_read_lock();
+
+    for (i = 0; (i < 256) && (count < DFC_DUMP_CLIENTS); i++)
+    {
+        client = sys_rcu_dereference(dfc->clients[i]);
+        while ((client != NULL) && (count < DFC_DUMP_CLIENTS))
+        {
+            uuid_unparse(client->uuid, uuid);
+            gf_proc_dump_build_key(key, "xlator.features.dfc.client", "%d",
+                                   count);
+            gf_proc_dump_add_section(key);
+
+            gf_proc_dump_write("uuid", "%s", uuid);
+            gf_proc_dump_write("index", "%u", client->index);
+            gf_proc_dump_write("refs", "%u", client->refs);
+            gf_proc_dump_write("next_txn", "%ld", client->next_txn);
+            gf_proc_dump_write("next_seq", "%ld", client->next_seq);
+            gf_proc_dump_write("next_receive", "%ld", client->next_receive);
+            gf_proc_dump_write("resume", "%ld/%ld", client->resume_txn,
+                               client->resume_seq);
+            gf_proc_dump_write("executing", "%u", client->executing);
+            gf_proc_dump_write("sort_slots", "%u", client->slots);
+            gf_proc_dump_write("sort_queued", "%s",
+                               list_empty(&client->sort_pending) ? "no"
+                                                                 : "yes");
+            gf_proc_dump_write("channel", "%s",
+                               (client->channel != NULL) ? "yes" : "no");
+            gf_proc_dump_write("idle", "%ld", time(NULL) - client->last);
+
+            count++;
+            client = sys_rcu_dereference(client->next);
+        }
+    }
+
+    sys_rcu_read_unlock();
+
+    if (count < dfc->client_count)
+    {
+        gf_proc_dump_build_key(key, "xlator.features.dfc", "clients");
+        gf_proc_dump_add_section(key);
+        gf_proc_dump_write("omitted", "%u", dfc->client_count - count);
+    }
+
+    dfc_trace_dump(dfc);
+    dfc_process_dump(dfc);
+
+    return 0;
+}
+
+static int32_t dfc_inodectx_dump(xlator_t * this, inode_t * inode)
+{
+    char key[GF_DUMP_MAX_BUF_LEN];
+    char uuid[64];
+    uint64_t value1, value2;
+    dfc_link_t * first, * link;
+    dfc_inode_t * ctx;
+    int32_t count;
+
+    // The link ring is protected by the inode lock. If it is busy, the
+    // inode is being processed and it is not dumped.
+    if (TRY_LOCK(&inode->lock) != 0)
+    {
+        return 0;
+    }
+
+    value1 = value2 = 0;
+    if ((__inode_ctx_get2(inode, this, &value1, &value2) != 0) ||
+        ((value1 == 0) && (value2 == 0)))
+    {
+        UNLOCK(&inode->lock);
+
+        return 0;
+    }
+
+    gf_proc_dump_build_key(key, "xlator.features.dfc", "inode");
+    gf_proc_dump_add_section(key);
+
+    if (value2 != 0)
+    {
+        ctx = (dfc_inode_t *)(uintptr_t)value2;
+        gf_proc_dump_write("size", "%zu", ctx->size);
+        gf_proc_dump_write("new_size", "%zu", ctx->new_size);
+    }
+
+    first = (dfc_link_t *)(uintptr_t)value1;
+    link = first;
+    count = 0;
+    while ((link != NULL) && (count < DFC_DUMP_LINKS))
+    {
+        uuid_unparse(link->request->client->uuid, uuid);
+        gf_proc_dump_build_key(key, "link", "%d", count);
+        gf_proc_dump_write(key, "client=%s, txn=%ld, seq=%ld", uuid,
+                           link->request->txn,
+                           link->request->seq & INT64_MAX);
+
+        count++;
+        link = list_entry(link->inode_list.next, dfc_link_t, inode_list);
+        if (link == first)
+        {
+            link = NULL;
+        }
+    }
+    if (link != NULL)
+    {
+        gf_proc_dump_write("links", "more than %d", DFC_DUMP_LINKS);
+    }
+
+    UNLOCK(&inode->lock);
+
+    return 0;
+}
+
 int32_t mem_acct_init(xlator_t * this)
 {
     SYS_ASSERT(this != NULL, "Current translator is NULL");
@@ -2347,6 +4682,22 @@ int32_t mem_acct_init(xlator_t * this)
            );
 }
 
+err_t dfc_parse_options(xlator_t * this, dfc_manager_t * dfc)
+{
+    GF_OPTION_INIT("sort-batch-bytes", dfc->batching.bytes, uint32, failed);
+    GF_OPTION_INIT("sort-batch-count", dfc->batching.count, uint32, failed);
+    GF_OPTION_INIT("sort-batch-delay", dfc->batching.delay, uint32, failed);
+    GF_OPTION_INIT("sort-batch-adaptive", dfc->batching.adaptive, bool,
+                   failed);
+    GF_OPTION_INIT("client-idle-timeout", dfc->idle_timeout, uint32, failed);
+    GF_OPTION_INIT("max-clients", dfc->max_clients, uint32, failed);
+
+    return 0;
+
+failed:
+    return EINVAL;
+}
+
 int32_t init(xlator_t * this)
 {
     dfc_manager_t * dfc;
@@ -2375,19 +4726,28 @@ int32_t init(xlator_t * this)
     );
 
     sys_lock_initialize(&dfc->lock);
-/*
+    dfc->refs = 1;
+    LOCK_INIT(&dfc->segment_lock);
+    INIT_LIST_HEAD(&dfc->segments);
+
     SYS_CALL(
-        dfc_parse_options, (this),
+        dfc_parse_options, (this, dfc),
         E(),
         GOTO(failed_dfc, &error)
     );
-*/
+
+    dfc_thread_initialize();
+    dfc_process_register(dfc);
+
     this->private = dfc;
 
     logD("The Distributed FOP Coordinator translator is ready");
 
     return 0;
 
+failed_dfc:
+    LOCK_DESTROY(&dfc->segment_lock);
+    SYS_FREE(dfc);
 failed:
     logE("The Distributed FOP Coordinator translator could not start. "
          "Error %d", error);
@@ -2404,13 +4764,71 @@ void fini(xlator_t * this)
     dfc = this->private;
     this->private = NULL;
 
-    SYS_FREE(dfc);
+    // Per thread data does not belong to any brick, so it is kept.
+    dfc_process_unregister(dfc);
+
+    // Segments are released once the sort channels do not reference this
+    // brick anymore.
+    dfc_manager_put(dfc);
 }
 
 SYS_GF_FOP_TABLE(dfc);
 SYS_GF_CBK_TABLE(dfc);
 
+struct xlator_dumpops dumpops =
+{
+    .priv     = dfc_priv_dump,
+    .inodectx = dfc_inodectx_dump
+};
+
 struct volume_options options[] =
 {
-    { }
+    { .key = { "sort-batch-bytes" },
+      .type = GF_OPTION_TYPE_INT,
+      .min = 0,
+      .max = DFC_SORT_MAX,
+      .default_value = "16384",
+      .description = "Amount of pending sort data that causes an immediate "
+                     "send to the client."
+    },
+    { .key = { "sort-batch-count" },
+      .type = GF_OPTION_TYPE_INT,
+      .min = 1,
+      .max = 65536,
+      .default_value = "64",
+      .description = "Number of pending dependency blocks that causes an "
+                     "immediate send to the client."
+    },
+    { .key = { "sort-batch-delay" },
+      .type = GF_OPTION_TYPE_INT,
+      .min = 0,
+      .max = 1000,
+      .default_value = "1",
+      .description = "Maximum time, in milliseconds, that sort data is "
+                     "retained to be sent with other pending data. 0 "
+                     "disables batching."
+    },
+    { .key = { "sort-batch-adaptive" },
+      .type = GF_OPTION_TYPE_BOOL,
+      .default_value = "on",
+      .description = "Widen the batching window under load and close it "
+                     "when the client is idle."
+    },
+    { .key = { "client-idle-timeout" },
+      .type = GF_OPTION_TYPE_INT,
+      .min = 0,
+      .max = 86400,
+      .default_value = "3600",
+      .description = "Time, in seconds, after which the state of a client "
+                     "without activity is released. 0 disables it."
+    },
+    { .key = { "max-clients" },
+      .type = GF_OPTION_TYPE_INT,
+      .min = 0,
+      .max = 1048576,
+      .default_value = "0",
+      .description = "Number of known clients above which idle clients are "
+                     "evicted more aggressively. 0 means no limit."
+    },
+    { .key = { NULL } }
 };
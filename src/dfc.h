@@ -23,13 +23,33 @@
 
 #define DFC_XATTR "trusted.dfc"
 
-#define DFC_XATTR_UUID   DFC_XATTR ".uuid"
-#define DFC_XATTR_ID     DFC_XATTR ".id"
-#define DFC_XATTR_SORT   DFC_XATTR ".sort"
-#define DFC_XATTR_TIME   DFC_XATTR ".time"
-#define DFC_XATTR_OFFSET DFC_XATTR ".offset"
-#define DFC_XATTR_SIZE   DFC_XATTR ".size"
-#define DFC_XATTR_VSIZE  DFC_XATTR ".virtual-size"
+#define DFC_XATTR_UUID    DFC_XATTR ".uuid"
+#define DFC_XATTR_ID      DFC_XATTR ".id"
+#define DFC_XATTR_SORT    DFC_XATTR ".sort"
+#define DFC_XATTR_DEPS    DFC_XATTR ".deps"
+#define DFC_XATTR_MUX     DFC_XATTR ".mux"
+#define DFC_XATTR_PROCESS DFC_XATTR ".process"
+#define DFC_XATTR_READY   DFC_XATTR ".ready"
+#define DFC_XATTR_RESUME  DFC_XATTR ".resume"
+#define DFC_XATTR_PARKED  DFC_XATTR ".parked"
+#define DFC_XATTR_FEATURES DFC_XATTR ".features"
+#define DFC_XATTR_TIME    DFC_XATTR ".time"
+#define DFC_XATTR_STATS   DFC_XATTR ".stats"
+#define DFC_XATTR_TRACE   DFC_XATTR ".trace"
+#define DFC_XATTR_OFFSET  DFC_XATTR ".offset"
+#define DFC_XATTR_SIZE    DFC_XATTR ".size"
+#define DFC_XATTR_VSIZE   DFC_XATTR ".virtual-size"
+
+// Optional behaviours negotiated on registration. Must match the client.
+// The client takes sort data from fop replies.
+#define DFC_FEATURE_PIGGYBACK 0x01
+// The server accepts DFC_XATTR_DEPS on single-child transactions.
+#define DFC_FEATURE_DEPS      0x02
+// The client polls a single sort channel for all bricks of a process.
+#define DFC_FEATURE_MUX       0x04
+
+// Root transaction ids advance by 1 << DFC_TXN_SHIFT. Must match the client.
+#define DFC_TXN_SHIFT 16
 
 enum dfc_mem_types
 {
@@ -37,6 +57,10 @@ enum dfc_mem_types
     dfc_mt_dfc_client_t,
     dfc_mt_dfc_sort_t,
     dfc_mt_dfc_inode_t,
+    dfc_mt_dfc_segment_t,
+    dfc_mt_dfc_channel_t,
+    dfc_mt_dfc_thread_t,
+    dfc_mt_dfc_event_t,
     dfc_mt_end
 };
 
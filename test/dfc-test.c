@@ -22,10 +22,13 @@
 #include "gfdfc.h"
 
 static int32_t child_count;
+static uint64_t * child_mask;
 
 #define DFC_TEST_FOP(_fop) \
-    SYS_CBK_CREATE(__dfc_test_##_fop##_cbk, io, ((dfc_transaction_t *, txn))) \
+    SYS_CBK_CREATE(__dfc_test_##_fop##_cbk, io, ((dfc_transaction_t *, txn), \
+                                                 (int32_t, idx))) \
     { \
+        dfc_reply(txn, idx, ((SYS_GF_WIND_CBK_TYPE(_fop) *)io)->xdata); \
         if (dfc_complete(txn)) \
         { \
             sys_gf_handler_call_##_fop##_unwind(NULL, 0, 0, NULL, NULL, io); \
@@ -39,8 +42,7 @@ static int32_t child_count;
         xlator_list_t * list; \
         int32_t idx; \
         SYS_CALL( \
-            dfc_begin, (xl->private, (1ULL << child_count) - 1ULL, NULL, \
-                        xdata, &txn), \
+            dfc_begin_mask, (xl->private, child_mask, NULL, xdata, &txn), \
             E(), \
             GOTO(failed) \
         ); \
@@ -55,7 +57,7 @@ static int32_t child_count;
             ); \
             SYS_IO(sys_gf_##_fop##_wind, (frame, NULL, list->xlator, \
                                        SYS_ARGS_NAMES((SYS_GF_ARGS_##_fop))), \
-                   SYS_CBK(__dfc_test_##_fop##_cbk, (txn)), NULL); \
+                   SYS_CBK(__dfc_test_##_fop##_cbk, (txn, idx)), NULL); \
             idx++; \
             sys_dict_release(xdata); \
         } \
@@ -222,6 +224,7 @@ int32_t init(xlator_t * xl)
 {
     xlator_list_t * list;
     dfc_t * dfc;
+    int32_t i;
 
     SYS_CALL(
         gfsys_initialize, (NULL, false),
@@ -240,15 +243,40 @@ int32_t init(xlator_t * xl)
         E(),
         RETVAL(-1)
     );
+    // All fop callbacks pass their replies to dfc_reply().
+    dfc_set_piggyback(dfc, true);
+
+    SYS_CALLOC(
+        &child_mask, dfc->words, gfdfc_mt_dfc_t,
+        E(),
+        GOTO(failed)
+    );
+    for (i = 0; i < child_count; i++)
+    {
+        child_mask[i / DFC_MASK_BITS] |= 1ULL << (i % DFC_MASK_BITS);
+    }
 
     xl->private = dfc;
 
+    return 0;
+
+failed:
+    dfc_terminate(dfc);
+
+    return -1;
+}
+
+int32_t dfc_test_priv_dump(xlator_t * xl)
+{
+    dfc_dump(xl->private);
+
     return 0;
 }
 
 int32_t fini(xlator_t * xl)
 {
     dfc_terminate(xl->private);
+    SYS_FREE(child_mask);
 
     return 0;
 }
@@ -256,6 +284,11 @@ int32_t fini(xlator_t * xl)
 SYS_GF_FOP_TABLE(dfc_test);
 SYS_GF_CBK_TABLE(dfc_test);
 
+struct xlator_dumpops dumpops =
+{
+    .priv = dfc_test_priv_dump
+};
+
 struct volume_options options[] =
 {
     { }